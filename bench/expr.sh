@@ -0,0 +1,24 @@
+#!/bin/sh
+# Serial front-end throughput on generated expression-heavy code.
+# usage: bench/expr.sh [megabytes]
+
+mb=${1:-16}
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+awk -v bytes=$((mb * 1000000)) 'BEGIN {
+    print "let a := 1;"
+    print "let b := 2;"
+    print "let c := 3;"
+    for (i = 0; size < bytes; i++) {
+        s = sprintf("a = a + %d - b * c - %d + b / 3 - a %% 7 + %d;\n", i % 13, i % 7, i % 5)
+        s = s sprintf("b = !a & b | c & !b | a <= c + %d * b;\n", i % 11)
+        s = s sprintf("c = { return (a - b) * (c + %d); } + a - { return c; };\n", i % 3)
+        printf "%s", s
+        size += length(s)
+    }
+}' > "$tmp/input.pavo"
+
+${CC:-cc} -O2 -pthread -o "$tmp/pavo" "$dir/../src/pavo.c" || exit 1
+"$tmp/pavo" --jobs 1 --bench-parse "$tmp/input.pavo"
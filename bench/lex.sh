@@ -0,0 +1,28 @@
+#!/bin/sh
+# Lexing and statement pre-scan throughput on a generated multi-megabyte
+# source, for the default (SSE2) build, the AVX2 build and the scalar
+# fallback. Only the pre-scan uses vector compares.
+# usage: bench/lex.sh [megabytes]
+
+mb=${1:-8}
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+awk -v bytes=$((mb * 1000000)) 'BEGIN {
+    for (i = 0; size < bytes; i++) {
+        s = sprintf("let identifier_%d := counter_value + %d - other_variable_name;   # comment %d\n", i, i * 7, i)
+        s = s sprintf("if flag_%d == 1 & !done {\n        total_sum = total_sum + %d;\n}\n\n", i, i)
+        printf "%s", s
+        size += length(s)
+    }
+}' > "$tmp/input.pavo"
+
+${CC:-cc} -O2 -pthread -o "$tmp/pavo" "$dir/../src/pavo.c" || exit 1
+${CC:-cc} -O2 -mavx2 -pthread -o "$tmp/pavo-avx2" "$dir/../src/pavo.c" || exit 1
+${CC:-cc} -O2 -DPAVO_SCALAR_LEXER -pthread -o "$tmp/pavo-scalar" "$dir/../src/pavo.c" || exit 1
+
+for build in pavo pavo-avx2 pavo-scalar; do
+    printf "%-12s " "$build"
+    "$tmp/$build" --bench-lex "$tmp/input.pavo" | sed '2s/^/             /'
+done
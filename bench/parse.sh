@@ -0,0 +1,31 @@
+#!/bin/sh
+# Front-end time on a generated multi-megabyte script for an increasing
+# number of parser threads.
+# usage: bench/parse.sh [megabytes]
+
+mb=${1:-16}
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+awk -v bytes=$((mb * 1000000)) 'BEGIN {
+    print "let total := 0;"
+    print "let flag := 1;"
+    for (i = 0; size < bytes; i++) {
+        s = sprintf("total = total + %d - flag;   # step %d\n", i, i)
+        s = s sprintf("if !flag & total | flag == %d {\n    flag = !flag;\n}\n", i % 2)
+        s = s sprintf("total = { return total - %d; };\n", i % 97)
+        printf "%s", s
+        size += length(s)
+    }
+}' > "$tmp/input.pavo"
+
+${CC:-cc} -O2 -pthread -o "$tmp/pavo" "$dir/../src/pavo.c" || exit 1
+
+cores=$(getconf _NPROCESSORS_ONLN)
+jobs=1
+while [ "$jobs" -lt "$cores" ]; do
+    "$tmp/pavo" --jobs "$jobs" --bench-parse "$tmp/input.pavo"
+    jobs=$((jobs * 2))
+done
+"$tmp/pavo" --jobs "$cores" --bench-parse "$tmp/input.pavo"
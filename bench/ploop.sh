@@ -0,0 +1,31 @@
+#!/bin/sh
+# Wall-clock execution time of bench/ploop.pavo for an increasing number of worker
+# threads, with the speedup over one thread.
+# usage: bench/ploop.sh [runs]
+
+runs=${1:-3}
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -O2 -pthread -o "$tmp/pavo" "$dir/../src/pavo.c" || exit 1
+
+# best "execution time" over $runs runs with N threads
+best() {
+    for _ in $(seq "$runs"); do
+        "$tmp/pavo" --jobs "$1" "$dir/ploop.pavo" | sed -n 's/^execution time: \([0-9.]*\) seconds$/\1/p'
+    done | sort -n | head -n 1
+}
+
+cores=$(getconf _NPROCESSORS_ONLN)
+serial=$(best 1)
+printf "%-6s %12s %8s\n" "jobs" "time (s)" "speedup"
+jobs=1
+while :; do
+    time=$serial
+    [ "$jobs" -gt 1 ] && time=$(best "$jobs")
+    printf "%-6s %12s %8s\n" "$jobs" "$time" "$(awk -v a="$serial" -v b="$time" 'BEGIN { printf "%.2fx", a / b }')"
+    [ "$jobs" -ge "$cores" ] && break
+    jobs=$((jobs * 2))
+    [ "$jobs" -gt "$cores" ] && jobs=$cores
+done
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Runs every benchmark program and reports the best execution time of
+# several runs: with the budget checks compiled out (-DPAVO_NO_BUDGETS), with
+# them built in but no limits given, and with limits given. The overhead
+# columns are relative to the build without checks.
+# usage: bench/run.sh [runs]    e.g. bench/run.sh 5 > bench_output.txt
+
+runs=${1:-3}
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -O2 -pthread -o "$tmp/pavo" "$dir/../src/pavo.c" || exit 1
+${CC:-cc} -O2 -pthread -DPAVO_NO_BUDGETS -o "$tmp/pavo-nobudgets" "$dir/../src/pavo.c" || exit 1
+
+# best "execution time" over $runs runs of: binary <args...>
+best() {
+    for _ in $(seq "$runs"); do
+        "$@" | sed -n 's/^execution time: \([0-9.]*\) seconds$/\1/p'
+    done | sort -n | head -n 1
+}
+
+overhead() {
+    awk -v a="$1" -v b="$2" 'BEGIN { printf "%.1f%%", (b - a) / a * 100 }'
+}
+
+printf "%-12s %12s %12s %12s %10s %10s\n" "benchmark" "no checks" "checks" "limits" "checks" "limits"
+for program in "$dir"/*.pavo; do
+    none=$(best "$tmp/pavo-nobudgets" "$program")
+    checks=$(best "$tmp/pavo" "$program")
+    limits=$(best "$tmp/pavo" --fuel 1000000000000 --mem-limit 1000000000 "$program")
+    printf "%-12s %12s %12s %12s %10s %10s\n" "$(basename "$program" .pavo)" "$none" "$checks" "$limits" \
+        "$(overhead "$none" "$checks")" "$(overhead "$none" "$limits")"
+done
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Startup cost of a script with a long initialization prelude: running it
+# from the source versus resuming it from a snapshot image taken after the
+# prelude.
+# usage: bench/snapshot.sh [runs]
+
+runs=${1:-3}
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+awk 'BEGIN {
+    for (i = 0; i < 90; i++) {
+        printf "let v%d := %d;\n", i, i * 7
+    }
+    print "let step := 0;"
+    print "loop step < 300000 {"
+    for (i = 0; i < 8; i++) {
+        printf "    v%d = v%d + v%d - step;\n", i, i, i + 1
+    }
+    print "    step = step + 1;"
+    print "}"
+    print "snapshot;"
+    for (i = 0; i < 90; i += 10) {
+        printf "print v%d;\n", i
+    }
+}' > "$tmp/prelude.pavo"
+
+${CC:-cc} -O2 -pthread -o "$tmp/pavo" "$dir/../src/pavo.c" || exit 1
+"$tmp/pavo" --snapshot "$tmp/prelude.img" "$tmp/prelude.pavo" > /dev/null || exit 1
+
+# best wall-clock time in seconds over $runs runs of: pavo <args...>
+best() {
+    for _ in $(seq "$runs"); do
+        start=$(date +%s%N)
+        "$tmp/pavo" "$@" > /dev/null
+        end=$(date +%s%N)
+        echo "$(( (end - start) / 1000 ))"
+    done | sort -n | head -n 1 | awk '{ printf "%.6f", $1 / 1e6 }'
+}
+
+source=$(best "$tmp/prelude.pavo")
+resume=$(best --resume "$tmp/prelude.img")
+printf "%-8s %12s\n" "start" "wall (s)"
+printf "%-8s %12s\n" "source" "$source"
+printf "%-8s %12s\n" "resume" "$resume"
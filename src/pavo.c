@@ -1,8 +1,29 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#if defined(__AVX2__) && !defined(PAVO_SCALAR_LEXER)
+#include <immintrin.h>
+#define PAVO_VECTOR_LEXER 32
+#elif defined(__SSE2__) && !defined(PAVO_SCALAR_LEXER)
+#include <emmintrin.h>
+#define PAVO_VECTOR_LEXER 16
+#endif
 
 // Maximum lengths for various components
 #define MAX_TOKEN_LEN 256
@@ -25,6 +46,8 @@ typedef enum {
     TOKEN_EQ_EQ,
     TOKEN_LESS_THAN,
     TOKEN_GREATER_THAN,
+    TOKEN_LESS_EQ,
+    TOKEN_GREATER_EQ,
     TOKEN_NOT_EQ,
     TOKEN_NOT, //!
     TOKEN_AND, //&
@@ -35,10 +58,23 @@ typedef enum {
     TOKEN_RETURN,
     TOKEN_LOOP,
     TOKEN_BREAK,
+    TOKEN_PLOOP,
+    TOKEN_REDUCE,
+    TOKEN_DOTDOT, //..
+    TOKEN_COLON,
+    TOKEN_COMMA,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_SNAPSHOT,
+    TOKEN_STAR,
+    TOKEN_SLASH,
+    TOKEN_PERCENT,
+    TOKEN_COUNT, // number of token types
 } TokenType;
 
 typedef enum{//0 false 1 true
     TYPE_INTEGER,
+    TYPE_BOOL,
     TYPE_UNKNOWN,
 } VarType;
 
@@ -46,8 +82,7 @@ typedef enum{//0 false 1 true
 typedef struct {
     TokenType type;
     char value[MAX_TOKEN_LEN];
-    int line;
-    int column;
+    int offset; // source position where scanning for the token started
 } Token;
 
 // AST node types
@@ -65,24 +100,56 @@ typedef enum {
     NODE_RETURN,
     NODE_LOOP,
     NODE_BREAK,
+    NODE_PLOOP,
+    NODE_SNAPSHOT,
 } NodeType;
 
-// AST node structure
+// AST node structure; the text at the end is allocated to fit
+// ploop reduction operators
+typedef enum {
+    REDUCE_ADD,
+    REDUCE_AND,
+    REDUCE_OR,
+    REDUCE_MAX,
+    REDUCE_MIN,
+    REDUCE_NONE,
+} ReduceOp;
+
 typedef struct ASTNode {
     NodeType type;
-    char value[MAX_TOKEN_LEN];  // Used for variable names and number values
     struct ASTNode* left;       // Used for assignment left side
     struct ASTNode* right;      // Used for assignment right side or print expression
     struct ASTNode* next;
     struct ConditionalBranch* cond_chain;
     struct ASTNode* condition; //loop condition
+    struct ParallelLoop* ploop; // range and reductions of a ploop
+    VarType vtype;              // inferred type of the node's value
+    long long lo, hi;           // inferred range of the node's value
+    struct BlockCache* cache;   // memoized results of a pure value block
+    ReduceOp fold;              // REDUCE_MAX/MIN: a ploop update that folds its value in
+    int value_size;
+    char value[];               // Used for variable names, number values and operators
 } ASTNode;
 
+// Smallest text allocation: room for any operator
+#define NODE_VALUE_MIN 4
+
 typedef struct ConditionalBranch {
     ASTNode* condition;
     ASTNode* body; //local scope
 } ConditionalBranch;
 
+// ploop i := start .. end reduce(op: var, ...) { body }
+#define MAX_REDUCTIONS 8
+
+typedef struct ParallelLoop {
+    ASTNode* start;
+    ASTNode* end;
+    int reduction_count;
+    ReduceOp ops[MAX_REDUCTIONS];
+    char reductions[MAX_REDUCTIONS][MAX_TOKEN_LEN];
+} ParallelLoop;
+
 //kell free!!!!!!!!
 
 // Symbol table entry
@@ -92,260 +159,588 @@ typedef struct {
     int value; //int es bool (0, 1)
 } Symbol;
 
-// Global variables for lexer
-char* source;
-int pos = 0;
-int line = 1;
-int column = 1;
-Symbol symbol_table[MAX_IDENTIFIERS];
-int symbol_count = 0;
+// Global variables for lexer (per thread, for the parallel front end)
+_Thread_local char* source;
+_Thread_local int source_len = 0;
+_Thread_local int pos = 0;
+_Thread_local Symbol symbol_table[MAX_IDENTIFIERS]; // private copies in ploop workers
+_Thread_local int symbol_count = 0;
+
+// Execution budgets for untrusted scripts
+// Fuel is charged at loop back-edges and memory at AST allocations, so
+// straight-line code pays nothing. Without limits both are effectively infinite.
+// Building with -DPAVO_NO_BUDGETS compiles the checks out (bench/run.sh uses
+// that build as the baseline for their overhead).
+#define EXIT_OUT_OF_FUEL 3
+#define EXIT_OUT_OF_MEMORY 4
+#define FUEL_SLICE 4096
+
+long long fuel_limit = LLONG_MAX;
+_Thread_local long long fuel_left = LLONG_MAX;
+// ploop workers share the fuel left when the loop started and draw it from
+// here in slices, so that together they cannot spend more than that
+_Thread_local atomic_llong* fuel_pool = NULL;
+long long memory_limit = LLONG_MAX;
+_Thread_local long long memory_used = 0;
+_Thread_local long long memory_peak = 0;
+
+void budget_report(const char* budget) {
+    fflush(stdout);
+    fprintf(stderr, "%s budget exhausted\n", budget);
+    if (fuel_limit != LLONG_MAX) {
+        long long left = fuel_pool == NULL && fuel_left > 0 ? fuel_left : 0;
+        fprintf(stderr, "  fuel: %lld of %lld used\n", fuel_limit - left, fuel_limit);
+    }
+    if (memory_limit != LLONG_MAX) {
+        fprintf(stderr, "  memory: %lld bytes in use (peak %lld) of %lld\n",
+                memory_used, memory_peak, memory_limit);
+    }
+}
+
+void out_of_fuel() {
+    budget_report("instruction");
+    exit(EXIT_OUT_OF_FUEL);
+}
+
+void refill_fuel();
 
-// Function to create a new AST node
-ASTNode* create_node(NodeType type) {
-    ASTNode* node = (ASTNode*)malloc(sizeof(ASTNode));
+// Charge one loop back-edge
+static inline void spend_fuel(long long cost) {
+#ifndef PAVO_NO_BUDGETS
+    fuel_left -= cost;
+    if (fuel_left < 0) {
+        refill_fuel();
+    }
+#else
+    (void)cost;
+#endif
+}
+
+// Account for an allocation before it is made
+void budget_charge(long long bytes) {
+#ifndef PAVO_NO_BUDGETS
+    memory_used += bytes;
+    if (memory_used > memory_peak) {
+        memory_peak = memory_used;
+    }
+    if (memory_used > memory_limit) {
+        budget_report("memory");
+        exit(EXIT_OUT_OF_MEMORY);
+    }
+#else
+    (void)bytes;
+#endif
+}
+
+void budget_release(long long bytes) {
+#ifndef PAVO_NO_BUDGETS
+    memory_used -= bytes;
+#else
+    (void)bytes;
+#endif
+}
+
+// Front-end errors exit, except in a parallel parse worker, which gives up on
+// its chunk instead and leaves the error to the serial front end
+_Thread_local jmp_buf* parse_recovery = NULL;
+
+// Nodes made since the last statement boundary while errors are recoverable,
+// so that the statement a recovery abandons half way can still be freed
+_Thread_local ASTNode** parse_pending = NULL;
+_Thread_local int parse_pending_count = 0;
+_Thread_local int parse_pending_capacity = 0;
+
+void track_pending(ASTNode* node) {
+    if (parse_pending_count == parse_pending_capacity) {
+        parse_pending_capacity = parse_pending_capacity == 0 ? 64 : parse_pending_capacity * 2;
+        parse_pending = realloc(parse_pending, parse_pending_capacity * sizeof(ASTNode*));
+    }
+    parse_pending[parse_pending_count++] = node;
+}
+
+// Free the nodes of an abandoned statement. Its children are in the list
+// too, so each node is freed on its own rather than with free_ast.
+void free_pending() {
+    for (int i = 0; i < parse_pending_count; i++) {
+        ASTNode* node = parse_pending[i];
+        if (node->cond_chain != NULL) {
+            free(node->cond_chain);
+            budget_release(sizeof(ConditionalBranch));
+        }
+        if (node->ploop != NULL) {
+            free(node->ploop);
+            budget_release(sizeof(ParallelLoop));
+        }
+        budget_release(sizeof(ASTNode) + node->value_size);
+        free(node);
+    }
+    parse_pending_count = 0;
+}
+
+// Function to create a new AST node holding a copy of text
+ASTNode* create_text_node(NodeType type, const char* text) {
+    int len = strlen(text) + 1;
+    int size = len > NODE_VALUE_MIN ? len : NODE_VALUE_MIN;
+    budget_charge(sizeof(ASTNode) + size);
+    ASTNode* node = (ASTNode*)malloc(sizeof(ASTNode) + size);
     node->type = type;
     node->left = NULL;
     node->right = NULL;
-    node->value[0] = '\0';
+    node->next = NULL;
+    node->cond_chain = NULL;
+    node->condition = NULL;
+    node->ploop = NULL;
+    node->vtype = TYPE_UNKNOWN;
+    node->lo = INT_MIN;
+    node->hi = INT_MAX;
+    node->cache = NULL;
+    node->fold = REDUCE_NONE;
+    node->value_size = size;
+    memcpy(node->value, text, len);
+    if (parse_recovery != NULL) {
+        track_pending(node);
+    }
     return node;
 }
 
-// Function to free an AST node and its children
+ASTNode* create_node(NodeType type) {
+    return create_text_node(type, "");
+}
+
+void free_block_cache(struct BlockCache* cache);
+
+// Function to free an AST node, its children and the statements following it
 void free_ast(ASTNode* node) {
-    if (node == NULL) return;
-    free_ast(node->left);
-    free_ast(node->right);
-    free(node);
+    while (node != NULL) {
+        ASTNode* next = node->next;
+        free_ast(node->left);
+        free_ast(node->right);
+        free_ast(node->condition);
+        if (node->cond_chain != NULL) {
+            free_ast(node->cond_chain->condition);
+            free_ast(node->cond_chain->body);
+            free(node->cond_chain);
+            budget_release(sizeof(ConditionalBranch));
+        }
+        if (node->cache != NULL) {
+            free_block_cache(node->cache);
+        }
+        if (node->ploop != NULL) {
+            free_ast(node->ploop->start);
+            free_ast(node->ploop->end);
+            free(node->ploop);
+            budget_release(sizeof(ParallelLoop));
+        }
+        budget_release(sizeof(ASTNode) + node->value_size);
+        free(node);
+        node = next;
+    }
+}
+
+// Line and column of a source position, computed only when an error is
+// reported. The line count goes up when a position lands on a newline.
+void source_position(int offset, int* line, int* column) {
+    *line = 1;
+    *column = offset + 1;
+    for (int i = 1; i <= offset; i++) {
+        if (source[i] == '\n') {
+            (*line)++;
+            *column = offset - i + 1;
+        }
+    }
+}
+
+void abandon_parse() {
+    if (parse_recovery != NULL) {
+        longjmp(*parse_recovery, 1);
+    }
 }
 
 // Lexer error handling
 void lexer_error() {
+    abandon_parse();
+    int line, column;
+    source_position(pos, &line, &column);
     fprintf(stderr, "Lexical error at line %d, column %d\n", line, column);
     exit(1);
 }
 
 // Get the current character
 char current_char() {
-    if (pos >= strlen(source)) return '\0';
+    if (pos >= source_len) return '\0';
     return source[pos];
 }
 
 // Advance to the next character
 void advance() {
     pos++;
-    column++;
-    if (current_char() == '\n') {
-        line++;
-        column = 1;
+}
+
+// Character classes scanned in runs by scan_run
+typedef enum {
+    CLASS_SPACE,
+    CLASS_DIGIT,
+    CLASS_IDENT,
+    CLASS_PLAIN, // anything but the statement structure characters { } ; #
+} CharClass;
+
+int in_class(char c, CharClass cls) {
+    switch (cls) {
+        case CLASS_SPACE: return isspace(c);
+        case CLASS_DIGIT: return isdigit(c);
+        case CLASS_IDENT: return isalnum(c) || c == '_';
+        case CLASS_PLAIN: return c != '{' && c != '}' && c != ';' && c != '#';
+    }
+    return 0;
+}
+
+// Position just past the run of class characters starting at p. Token runs
+// are a few bytes long, too short for vector compares to pay for their setup.
+int scan_run(int p, CharClass cls) {
+    while (p < source_len && in_class(source[p], cls)) {
+        p++;
+    }
+    return p;
+}
+
+#ifdef PAVO_VECTOR_LEXER
+#if PAVO_VECTOR_LEXER == 32
+typedef __m256i vec_t;
+#define vec_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vec_set1 _mm256_set1_epi8
+#define vec_eq _mm256_cmpeq_epi8
+#define vec_or _mm256_or_si256
+#define vec_mask(v) (unsigned)_mm256_movemask_epi8(v)
+#else
+typedef __m128i vec_t;
+#define vec_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define vec_set1 _mm_set1_epi8
+#define vec_eq _mm_cmpeq_epi8
+#define vec_or _mm_or_si128
+#define vec_mask(v) (unsigned)_mm_movemask_epi8(v)
+#endif
+#endif
+
+// Position of the first statement structure character ({ } ; #) from p.
+// The pre-scan of the parallel front end crosses whole statements this way,
+// so whole vectors are tested at once and only the tail goes one by one.
+int scan_plain(int p) {
+#ifdef PAVO_VECTOR_LEXER
+    while (p + PAVO_VECTOR_LEXER <= source_len) {
+        vec_t v = vec_load(source + p);
+        vec_t braces = vec_or(vec_eq(v, vec_set1('{')), vec_eq(v, vec_set1('}')));
+        unsigned special = vec_mask(vec_or(braces, vec_or(vec_eq(v, vec_set1(';')), vec_eq(v, vec_set1('#')))));
+        if (special != 0) {
+            return p + __builtin_ctz(special);
+        }
+        p += PAVO_VECTOR_LEXER;
     }
+#endif
+    return scan_run(p, CLASS_PLAIN);
 }
 
 // Skip whitespace
 void skip_whitespace() {
-    while (current_char()) {
-        if (isspace(current_char())){
-            advance();
-        } else if (current_char()=='#'){
-            while (current_char() && current_char() != '\n'){
-                advance();
-            }
+    while (pos < source_len) {
+        pos = scan_run(pos, CLASS_SPACE);
+        if (current_char()=='#'){
+            const char* newline = memchr(source + pos, '\n', source_len - pos);
+            pos = newline != NULL ? (int)(newline - source) : source_len;
         } else {
             break;
         }
     }
 }
 
-// Get the next token from input (lexer)
-Token get_next_token() {
-    Token token;
-    token.line = line;
-    token.column = column;
+// Copy the source text from start up to pos into the token value
+void set_token_text(Token* token, int start) {
+    int length = pos - start;
+    if (length >= MAX_TOKEN_LEN) {
+        pos = start;
+        lexer_error();
+    }
+    memcpy(token->value, source + start, length);
+    token->value[length] = '\0';
+}
+
+// Lex the next token from input into token (the parser lexes straight into
+// current_token instead of copying a returned Token)
+void lex_token(Token* token) {
+    token->offset = pos;
 
     skip_whitespace();
 
     if (current_char() == '\0') {
-        token.type = TOKEN_EOF;
-        token.value[0] = '\0';
-        return token;
+        token->type = TOKEN_EOF;
+        token->value[0] = '\0';
+        return;
     }
 
     // Handle numbers
     if (isdigit(current_char())) {
-        int i = 0;
-        while (current_char() && isdigit(current_char())) {
-            token.value[i++] = current_char();
-            advance();
-        }
-        token.value[i] = '\0';
-        token.type = TOKEN_INTEGER;
-        return token;
+        int start = pos;
+        pos = scan_run(pos, CLASS_DIGIT);
+        set_token_text(token, start);
+        token->type = TOKEN_INTEGER;
+        return;
     }
 
     // Handle identifiers and keywords
     if (isalpha(current_char())) {
-        int i = 0;
-        while (current_char() && (isalnum(current_char()) || current_char() == '_')) {
-            token.value[i++] = current_char();
-            advance();
-        }
-        token.value[i] = '\0';
+        int start = pos;
+        pos = scan_run(pos, CLASS_IDENT);
+        set_token_text(token, start);
 
         // Check for keywords
-        if (strcmp(token.value, "return")==0){
-            token.type = TOKEN_RETURN;
-        } else if (strcmp(token.value, "loop")==0){
-            token.type = TOKEN_LOOP;
-        } else if (strcmp(token.value, "break")==0){
-            token.type = TOKEN_BREAK;
-        } else if (strcmp(token.value, "let") == 0) {
-            token.type = TOKEN_LET;
-        } else if (strcmp(token.value, "print") == 0) {
-            token.type = TOKEN_PRINT;
-        } else if (strcmp(token.value, "if") == 0) {
-            token.type = TOKEN_IF;
+        if (strcmp(token->value, "return")==0){
+            token->type = TOKEN_RETURN;
+        } else if (strcmp(token->value, "loop")==0){
+            token->type = TOKEN_LOOP;
+        } else if (strcmp(token->value, "break")==0){
+            token->type = TOKEN_BREAK;
+        } else if (strcmp(token->value, "let") == 0) {
+            token->type = TOKEN_LET;
+        } else if (strcmp(token->value, "print") == 0) {
+            token->type = TOKEN_PRINT;
+        } else if (strcmp(token->value, "if") == 0) {
+            token->type = TOKEN_IF;
+        } else if (strcmp(token->value, "ploop") == 0) {
+            token->type = TOKEN_PLOOP;
+        } else if (strcmp(token->value, "reduce") == 0) {
+            token->type = TOKEN_REDUCE;
+        } else if (strcmp(token->value, "snapshot") == 0) {
+            token->type = TOKEN_SNAPSHOT;
         } else {
-            token.type = TOKEN_IDENTIFIER;
+            token->type = TOKEN_IDENTIFIER;
         }
-        return token;
+        return;
     }
 
     if (current_char() == ':'){
         advance();
         if (current_char()=='='){
-            token.type = TOKEN_COLON_EQUALS;
-            token.value[0] = ':';
-            token.value[1] = '=';
-            token.value[2] = '\0';
+            token->type = TOKEN_COLON_EQUALS;
+            token->value[0] = ':';
+            token->value[1] = '=';
+            token->value[2] = '\0';
+            advance();
+            return;
+        }
+        token->type = TOKEN_COLON;
+        token->value[0] = ':';
+        token->value[1] = '\0';
+        return;
+    }
+
+    if (current_char() == '.'){
+        advance();
+        if (current_char()=='.'){
+            token->type = TOKEN_DOTDOT;
+            token->value[0] = '.';
+            token->value[1] = '.';
+            token->value[2] = '\0';
             advance();
-            return token;
+            return;
         }
         lexer_error();
     }
 
+    if (current_char()==','){
+        token->type = TOKEN_COMMA;
+        token->value[0] = ',';
+        token->value[1] = '\0';
+        advance();
+        return;
+    }
+
+    if (current_char()=='('){
+        token->type = TOKEN_LPAREN;
+        token->value[0] = '(';
+        token->value[1] = '\0';
+        advance();
+        return;
+    }
+
+    if (current_char()==')'){
+        token->type = TOKEN_RPAREN;
+        token->value[0] = ')';
+        token->value[1] = '\0';
+        advance();
+        return;
+    }
+
     // Handle special characters
     if (current_char() == '=') {
         advance();
         if (current_char()=='='){
-            token.type = TOKEN_EQ_EQ;
-            token.value[0] = '=';
-            token.value[1] = '=';
-            token.value[2] = '\0';
+            token->type = TOKEN_EQ_EQ;
+            token->value[0] = '=';
+            token->value[1] = '=';
+            token->value[2] = '\0';
             advance();
-            return token;
+            return;
         }
-        token.type = TOKEN_EQUALS;
-        token.value[0] = '=';
-        token.value[1] = '\0';
-        return token;
+        token->type = TOKEN_EQUALS;
+        token->value[0] = '=';
+        token->value[1] = '\0';
+        return;
     }
 
     if (current_char()=='<') {
-        token.type = TOKEN_LESS_THAN;
-        token.value[0] = '<';
-        token.value[1] = '\0';
         advance();
-        return token;
+        if (current_char()=='='){
+            token->type = TOKEN_LESS_EQ;
+            token->value[0] = '<';
+            token->value[1] = '=';
+            token->value[2] = '\0';
+            advance();
+            return;
+        }
+        token->type = TOKEN_LESS_THAN;
+        token->value[0] = '<';
+        token->value[1] = '\0';
+        return;
     }
 
     if (current_char()=='>'){
-        token.type = TOKEN_GREATER_THAN;
-        token.value[0] = '>';
-        token.value[1] = '\0';
         advance();
-        return token;
+        if (current_char()=='='){
+            token->type = TOKEN_GREATER_EQ;
+            token->value[0] = '>';
+            token->value[1] = '=';
+            token->value[2] = '\0';
+            advance();
+            return;
+        }
+        token->type = TOKEN_GREATER_THAN;
+        token->value[0] = '>';
+        token->value[1] = '\0';
+        return;
     }
 
     if (current_char()=='!'){
         advance();
         if (current_char()=='='){
-            token.type = TOKEN_NOT_EQ;
-            token.value[0] = '!';
-            token.value[1] = '=';
-            token.value[2] = '\0';
+            token->type = TOKEN_NOT_EQ;
+            token->value[0] = '!';
+            token->value[1] = '=';
+            token->value[2] = '\0';
             advance();
         }  else {
-            token.type = TOKEN_NOT;
-            token.value[0] = '!';
-            token.value[1] = '\0';
+            token->type = TOKEN_NOT;
+            token->value[0] = '!';
+            token->value[1] = '\0';
         }
-        return token;
+        return;
     }
 
     if (current_char()=='&'){
-        token.type = TOKEN_AND;
-        token.value[0] = '&';
-        token.value[1] = '\0';
+        token->type = TOKEN_AND;
+        token->value[0] = '&';
+        token->value[1] = '\0';
         advance();
-        return token;
+        return;
     }
 
     if (current_char()=='|'){
-        token.type = TOKEN_OR;
-        token.value[0] = '|';
-        token.value[1] = '\0';
+        token->type = TOKEN_OR;
+        token->value[0] = '|';
+        token->value[1] = '\0';
         advance();
-        return token;
+        return;
     }
 
     if (current_char() == ';') {
-        token.type = TOKEN_SEMICOLON;
-        token.value[0] = ';';
-        token.value[1] = '\0';
+        token->type = TOKEN_SEMICOLON;
+        token->value[0] = ';';
+        token->value[1] = '\0';
         advance();
-        return token;
+        return;
     }
 
     if (current_char()=='+'){
-        token.type = TOKEN_PLUS;
-        token.value[0] = '+';
-        token.value[1] = '\0';
+        token->type = TOKEN_PLUS;
+        token->value[0] = '+';
+        token->value[1] = '\0';
         advance();
-        return token;
+        return;
     }
 
     if (current_char()=='-'){
-        token.type = TOKEN_MINUS;
-        token.value[0] = '-';
-        token.value[1] = '\0';
+        token->type = TOKEN_MINUS;
+        token->value[0] = '-';
+        token->value[1] = '\0';
+        advance();
+        return;
+    }
+
+    if (current_char()=='*'){
+        token->type = TOKEN_STAR;
+        token->value[0] = '*';
+        token->value[1] = '\0';
+        advance();
+        return;
+    }
+
+    if (current_char()=='/'){
+        token->type = TOKEN_SLASH;
+        token->value[0] = '/';
+        token->value[1] = '\0';
+        advance();
+        return;
+    }
+
+    if (current_char()=='%'){
+        token->type = TOKEN_PERCENT;
+        token->value[0] = '%';
+        token->value[1] = '\0';
         advance();
-        return token;
+        return;
     }
 
     if (current_char()=='{'){
-        token.type = TOKEN_LBRACE;
-        token.value[0] = '{';
-        token.value[1] = '\0';
+        token->type = TOKEN_LBRACE;
+        token->value[0] = '{';
+        token->value[1] = '\0';
         advance();
-        return token;
+        return;
     }
 
     if (current_char()=='}'){
-        token.type = TOKEN_RBRACE;
-        token.value[0] = '}';
-        token.value[1] = '\0';
+        token->type = TOKEN_RBRACE;
+        token->value[0] = '}';
+        token->value[1] = '\0';
         advance();
-        return token;
+        return;
     }
 
     lexer_error();
-    token.type = TOKEN_EOF;  // To satisfy compiler
+    token->type = TOKEN_EOF;  // To satisfy compiler
+    return;
+}
+
+Token get_next_token() {
+    Token token;
+    lex_token(&token);
     return token;
 }
 
 // Parser variables
-Token current_token;
+_Thread_local Token current_token;
 
 // Parser error handling
 void parser_error() {
-    fprintf(stderr, "Syntax error at line %d, column %d\n",
-            current_token.line, current_token.column);
+    abandon_parse();
+    int line, column;
+    source_position(current_token.offset, &line, &column);
+    fprintf(stderr, "Syntax error at line %d, column %d\n", line, column);
     exit(1);
 }
 
 // Consume a token of expected type
 void eat(TokenType type) {
     if (current_token.type == type) {
-        current_token = get_next_token();
+        lex_token(&current_token);
     } else {
         parser_error();
     }
@@ -355,119 +750,108 @@ void eat(TokenType type) {
 ASTNode* parse_expression();
 ASTNode* parse_statement();
 ASTNode* parse_block();
+ASTNode* parse_ploop();
+
+// Binary operators, indexed by token type. Expressions are parsed by
+// precedence climbing over this table, so an operator is one entry here;
+// tokens with precedence 0 end an expression. Comparisons bind loosest and
+// do not chain, and the operand of a prefix `!` extends over everything that
+// binds tighter than `&`.
+typedef enum {
+    PREC_NONE,
+    PREC_COMPARE,
+    PREC_OR,
+    PREC_AND,
+    PREC_NOT,
+    PREC_ADD,
+    PREC_MUL,
+} Precedence;
 
-// Parse a primary expression (number or variable)
+typedef struct {
+    unsigned char precedence;
+    unsigned char chains;       // left associative; comparisons are not
+    unsigned char node_type;
+    char text[3];
+} InfixOperator;
+
+const InfixOperator infix_operators[TOKEN_COUNT] = {
+    [TOKEN_EQ_EQ] = {PREC_COMPARE, 0, NODE_COMPARE, "=="},
+    [TOKEN_NOT_EQ] = {PREC_COMPARE, 0, NODE_COMPARE, "!="},
+    [TOKEN_LESS_THAN] = {PREC_COMPARE, 0, NODE_COMPARE, "<"},
+    [TOKEN_GREATER_THAN] = {PREC_COMPARE, 0, NODE_COMPARE, ">"},
+    [TOKEN_LESS_EQ] = {PREC_COMPARE, 0, NODE_COMPARE, "<="},
+    [TOKEN_GREATER_EQ] = {PREC_COMPARE, 0, NODE_COMPARE, ">="},
+    [TOKEN_OR] = {PREC_OR, 1, NODE_LOGIC, "|"},
+    [TOKEN_AND] = {PREC_AND, 1, NODE_LOGIC, "&"},
+    [TOKEN_PLUS] = {PREC_ADD, 1, NODE_BINOP, "+"},
+    [TOKEN_MINUS] = {PREC_ADD, 1, NODE_BINOP, "-"},
+    [TOKEN_STAR] = {PREC_MUL, 1, NODE_BINOP, "*"},
+    [TOKEN_SLASH] = {PREC_MUL, 1, NODE_BINOP, "/"},
+    [TOKEN_PERCENT] = {PREC_MUL, 1, NODE_BINOP, "%"},
+};
+
+ASTNode* parse_binary(int min_precedence);
+
+// Parse a primary expression (number, variable, block, !operand or (expression))
 ASTNode* parse_primary() {
     ASTNode* node;
 
     switch (current_token.type) {
         case TOKEN_INTEGER: {
-            node = create_node(NODE_NUMBER);
-            strcpy(node->value, current_token.value);
+            node = create_text_node(NODE_NUMBER, current_token.value);
             eat(TOKEN_INTEGER);
             return node;
         }
         case TOKEN_IDENTIFIER: {
-            node = create_node(NODE_VARIABLE);
-            strcpy(node->value, current_token.value);
+            node = create_text_node(NODE_VARIABLE, current_token.value);
             eat(TOKEN_IDENTIFIER);
             return node;
         }
         case TOKEN_LBRACE: {
             return parse_block();
         }
+        case TOKEN_NOT: {
+            eat(TOKEN_NOT);
+            node = create_text_node(NODE_LOGIC, "!");
+            node->right = parse_binary(PREC_NOT);
+            return node;
+        }
+        case TOKEN_LPAREN: {
+            eat(TOKEN_LPAREN);
+            node = parse_expression();
+            eat(TOKEN_RPAREN);
+            return node;
+        }
         default:
             parser_error();
             return NULL;  // To satisfy compiler
     }
 }
 
-ASTNode* parse_arithmetic() {
+// Parse operands joined by operators of at least the given precedence
+ASTNode* parse_binary(int min_precedence) {
     ASTNode* node = parse_primary();
 
-    while (current_token.type==TOKEN_PLUS || current_token.type==TOKEN_MINUS) {
-        TokenType op_type = current_token.type;
-        eat(op_type);
-
-        ASTNode* new_node = create_node(NODE_BINOP);
-        new_node->left = node;
-        strcpy(new_node->value, op_type==TOKEN_PLUS ? "+" : "-");
-        new_node->right = parse_primary();
-
-        node = new_node;
-    }
-
-    return node;
-}
-
-//LOGICAL:
-ASTNode* parse_not() {
-    if (current_token.type == TOKEN_NOT){
-        eat(TOKEN_NOT);
-        ASTNode* node = create_node(NODE_LOGIC);
-        strcpy(node->value, "!");
-        node->right = parse_not();
-        return node;
-    }
-    return parse_arithmetic();
-}
-
-ASTNode* parse_and(){
-    ASTNode* node = parse_not();
+    while (1) {
+        const InfixOperator* op = &infix_operators[current_token.type];
+        if (op->precedence == PREC_NONE || op->precedence < min_precedence) {
+            return node;
+        }
+        eat(current_token.type);
 
-    while (current_token.type == TOKEN_AND){
-        eat(TOKEN_AND);
-        ASTNode* new_node = create_node(NODE_LOGIC);
+        ASTNode* new_node = create_text_node(op->node_type, op->text);
         new_node->left = node;
-        strcpy(new_node->value, "&");
-        new_node->right = parse_not();
+        new_node->right = parse_binary(op->precedence + 1);
         node = new_node;
-    }
-    return node;
-}
 
-ASTNode* parse_logical() {
-    ASTNode* node = parse_and();
-
-    while (current_token.type==TOKEN_OR){
-        eat(TOKEN_OR);
-        ASTNode* new_node = create_node(NODE_LOGIC);
-        new_node->left = node;
-        strcpy(new_node->value, "|");
-        new_node->right = parse_and();
-        node = new_node;
+        if (!op->chains && infix_operators[current_token.type].precedence == op->precedence) {
+            parser_error();
+        }
     }
-    return node;
 }
 
 ASTNode* parse_expression() {
-    ASTNode* node = parse_logical();  // Start with logical operators
-
-    // Then handle comparisons
-    if (current_token.type == TOKEN_EQ_EQ ||
-        current_token.type == TOKEN_LESS_THAN ||
-        current_token.type == TOKEN_GREATER_THAN ||
-        current_token.type == TOKEN_NOT_EQ) {
-
-        TokenType optype = current_token.type;
-        eat(optype);
-
-        ASTNode* new_node = create_node(NODE_COMPARE);
-        new_node->left = node;
-
-        switch(optype) {
-            case TOKEN_EQ_EQ: strcpy(new_node->value, "=="); break;
-            case TOKEN_LESS_THAN: strcpy(new_node->value, "<"); break;
-            case TOKEN_GREATER_THAN: strcpy(new_node->value, ">"); break;
-            case TOKEN_NOT_EQ: strcpy(new_node->value, "!="); break;
-            default: printf("goofy token\n"); break;
-        }
-
-        new_node->right = parse_logical();  // Parse right side as logical expression
-        return new_node;
-    }
-
-    return node;
+    return parse_binary(PREC_COMPARE);
 }
 
 ASTNode* parse_block();
@@ -492,11 +876,11 @@ ASTNode* parse_statement() {
             if (current_token.type != TOKEN_IDENTIFIER) {
                 parser_error();
             }
-            node->left = create_node(NODE_VARIABLE);
-            strcpy(node->left->value, current_token.value);
+            node->left = create_text_node(NODE_VARIABLE, current_token.value);
             eat(TOKEN_IDENTIFIER);
 
             if (current_token.type != TOKEN_COLON_EQUALS){
+                abandon_parse();
                 fprintf(stderr, "must use := when initializing\n");
                 exit(1);
             }
@@ -508,11 +892,11 @@ ASTNode* parse_statement() {
         }
         case TOKEN_IDENTIFIER: {
             node = create_node(NODE_REASSIGN);
-            node->left = create_node(NODE_VARIABLE);
-            strcpy(node->left->value, current_token.value);
+            node->left = create_text_node(NODE_VARIABLE, current_token.value);
             eat(TOKEN_IDENTIFIER);
 
             if (current_token.type != TOKEN_EQUALS) {
+                abandon_parse();
                 fprintf(stderr, "must use = for reassignment\n");
                 exit(1);
             }
@@ -527,13 +911,16 @@ ASTNode* parse_statement() {
 
             node = create_node(NODE_IF_STMT);
 
+            budget_charge(sizeof(ConditionalBranch));
             ConditionalBranch* branch = malloc(sizeof(ConditionalBranch));
+            branch->condition = NULL;
+            branch->body = NULL;
+            node->cond_chain = branch;      // owned by the node if parsing stops
             branch->condition = parse_expression();
             branch->body = parse_block();
 
             ConditionalBranch* current = branch;
 
-            node->cond_chain = branch;
             return node;
         }
         case TOKEN_LOOP: {
@@ -554,16 +941,280 @@ ASTNode* parse_statement() {
             eat(TOKEN_SEMICOLON);
             return node;
         }
+        case TOKEN_PLOOP:
+            return parse_ploop();
+        case TOKEN_SNAPSHOT:
+            eat(TOKEN_SNAPSHOT);
+            eat(TOKEN_SEMICOLON);
+            return create_node(NODE_SNAPSHOT);
         default:
             parser_error();
             return NULL;  // To satisfy compiler
     }
 }
 
+// Semantic errors found while parsing, reported at the statement's position
+void semantic_error(int offset, const char* format, ...) {
+    abandon_parse();
+    int line, column;
+    va_list args;
+    source_position(offset, &line, &column);
+    fprintf(stderr, "Semantic error at line %d, column %d: ", line, column);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+int find_reduction(ParallelLoop* loop, const char* name) {
+    for (int i = 0; i < loop->reduction_count; i++) {
+        if (strcmp(loop->reductions[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Whether an expression reads the named variable
+int mentions(ASTNode* node, const char* name) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_VARIABLE && strcmp(node->value, name) == 0) {
+            return 1;
+        }
+        if (mentions(node->left, name) || mentions(node->right, name) ||
+            mentions(node->condition, name)) {
+            return 1;
+        }
+        if (node->cond_chain != NULL &&
+            (mentions(node->cond_chain->condition, name) || mentions(node->cond_chain->body, name))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether a statement list declares the named variable with let
+int declares(ASTNode* node, const char* name) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_ASSIGN && strcmp(node->left->value, name) == 0) {
+            return 1;
+        }
+        if (declares(node->left, name) || declares(node->right, name) ||
+            declares(node->condition, name)) {
+            return 1;
+        }
+        if (node->cond_chain != NULL &&
+            (declares(node->cond_chain->condition, name) || declares(node->cond_chain->body, name))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether an expression assigns the named variable, with let or =
+int writes(ASTNode* node, const char* name) {
+    for (; node != NULL; node = node->next) {
+        if ((node->type == NODE_ASSIGN || node->type == NODE_REASSIGN) &&
+            strcmp(node->left->value, name) == 0) {
+            return 1;
+        }
+        if (writes(node->left, name) || writes(node->right, name) ||
+            writes(node->condition, name)) {
+            return 1;
+        }
+        if (node->cond_chain != NULL &&
+            (writes(node->cond_chain->condition, name) || writes(node->cond_chain->body, name))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Variables declared in a ploop body are private to an iteration. Otherwise
+// the body may only write its reduction variables: +, & and | reductions
+// in the form r = r op expr (r = r + a - b for sums), max and min reductions
+// as r = expr, which folds expr into r. Reductions are not read otherwise, so
+// that iterations can run in any order on private copies that are combined
+// at the end.
+int reduction_terms(ASTNode* update, ASTNode* ploop, int r, int negated, int in_loop, int offset);
+
+void check_ploop_body(ASTNode* node, ASTNode* ploop, int in_loop, int offset) {
+    ParallelLoop* loop = ploop->ploop;
+
+    for (; node != NULL; node = node->next) {
+        switch (node->type) {
+            case NODE_PRINT:
+                semantic_error(offset, "print is not allowed in a ploop body");
+                break;
+            case NODE_ASSIGN:
+                if (strcmp(node->left->value, ploop->left->value) == 0 ||
+                    find_reduction(loop, node->left->value) >= 0) {
+                    semantic_error(offset, "ploop body cannot declare variable %s", node->left->value);
+                }
+                check_ploop_body(node->right, ploop, in_loop, offset);
+                continue;
+            case NODE_PLOOP:
+                semantic_error(offset, "nested ploop is not supported");
+                break;
+            case NODE_BREAK:
+                if (!in_loop) {
+                    semantic_error(offset, "break is not allowed in a ploop body");
+                }
+                break;
+            case NODE_VARIABLE: {
+                int r = find_reduction(loop, node->value);
+                if (r >= 0) {
+                    semantic_error(offset, "reduction variable %s can only be read by its update",
+                                   node->value);
+                }
+                break;
+            }
+            case NODE_REASSIGN: {
+                const char* name = node->left->value;
+                if (strcmp(name, ploop->left->value) == 0) {
+                    semantic_error(offset, "ploop body assigns its loop variable %s", name);
+                }
+                int r = find_reduction(loop, name);
+                if (r < 0 && declares(ploop->right, name)) {
+                    check_ploop_body(node->right, ploop, in_loop, offset);
+                    continue;
+                }
+                if (r < 0) {
+                    semantic_error(offset, "ploop body writes shared variable %s", name);
+                }
+                if (loop->ops[r] == REDUCE_MAX || loop->ops[r] == REDUCE_MIN) {
+                    if (mentions(node->right, name)) {
+                        semantic_error(offset, "reduction variable %s must be updated as it is reduced", name);
+                    }
+                    node->fold = loop->ops[r];
+                    check_ploop_body(node->right, ploop, in_loop, offset);
+                    continue;
+                }
+
+                if (reduction_terms(node->right, ploop, r, 0, in_loop, offset) != 1) {
+                    semantic_error(offset, "reduction variable %s must be updated as it is reduced", name);
+                }
+                continue;
+            }
+            default:
+                break;
+        }
+
+        int inner = in_loop || node->type == NODE_LOOP;
+        check_ploop_body(node->left, ploop, inner, offset);
+        check_ploop_body(node->right, ploop, inner, offset);
+        check_ploop_body(node->condition, ploop, inner, offset);
+        if (node->cond_chain != NULL) {
+            check_ploop_body(node->cond_chain->condition, ploop, inner, offset);
+            check_ploop_body(node->cond_chain->body, ploop, inner, offset);
+        }
+    }
+}
+
+// Walk the update of a +, & or | reduction r, which may combine any number
+// of terms with r's operator (and, for +, subtract them). Terms that are not
+// r itself must not read it. Returns how many times r is a term, or -1 if it
+// is read anywhere else or subtracted.
+int reduction_terms(ASTNode* update, ASTNode* ploop, int r, int negated, int in_loop, int offset) {
+    ParallelLoop* loop = ploop->ploop;
+    const char* name = loop->reductions[r];
+    const char* op = loop->ops[r] == REDUCE_ADD ? "+" : loop->ops[r] == REDUCE_AND ? "&" : "|";
+    NodeType type = loop->ops[r] == REDUCE_ADD ? NODE_BINOP : NODE_LOGIC;
+
+    if (update->type == NODE_VARIABLE && strcmp(update->value, name) == 0) {
+        return negated ? -1 : 1;
+    }
+    if (update->type == type && update->left != NULL) {
+        int minus = loop->ops[r] == REDUCE_ADD && strcmp(update->value, "-") == 0;
+        if (minus || strcmp(update->value, op) == 0) {
+            int left = reduction_terms(update->left, ploop, r, negated, in_loop, offset);
+            int right = reduction_terms(update->right, ploop, r, negated ^ minus, in_loop, offset);
+            return left < 0 || right < 0 ? -1 : left + right;
+        }
+    }
+    if (mentions(update, name)) {
+        return -1;
+    }
+    check_ploop_body(update, ploop, in_loop, offset);
+    return 0;
+}
+
+ASTNode* parse_ploop() {
+    int offset = current_token.offset;
+    eat(TOKEN_PLOOP);
+
+    ASTNode* node = create_node(NODE_PLOOP);
+    budget_charge(sizeof(ParallelLoop));
+    ParallelLoop* loop = malloc(sizeof(ParallelLoop));
+    loop->start = NULL;
+    loop->end = NULL;
+    loop->reduction_count = 0;
+    node->ploop = loop;
+
+    if (current_token.type != TOKEN_IDENTIFIER) {
+        parser_error();
+    }
+    node->left = create_text_node(NODE_VARIABLE, current_token.value);
+    eat(TOKEN_IDENTIFIER);
+    eat(TOKEN_COLON_EQUALS);
+
+    loop->start = parse_expression();
+    eat(TOKEN_DOTDOT);
+    loop->end = parse_expression();
+
+    if (current_token.type == TOKEN_REDUCE) {
+        eat(TOKEN_REDUCE);
+        eat(TOKEN_LPAREN);
+        while (1) {
+            ReduceOp op;
+            if (current_token.type == TOKEN_PLUS) {
+                op = REDUCE_ADD;
+            } else if (current_token.type == TOKEN_AND) {
+                op = REDUCE_AND;
+            } else if (current_token.type == TOKEN_OR) {
+                op = REDUCE_OR;
+            } else if (current_token.type == TOKEN_IDENTIFIER && strcmp(current_token.value, "max") == 0) {
+                op = REDUCE_MAX;
+            } else if (current_token.type == TOKEN_IDENTIFIER && strcmp(current_token.value, "min") == 0) {
+                op = REDUCE_MIN;
+            } else {
+                parser_error();
+                return NULL;
+            }
+            eat(current_token.type);
+            eat(TOKEN_COLON);
+
+            if (current_token.type != TOKEN_IDENTIFIER) {
+                parser_error();
+            }
+            if (find_reduction(loop, current_token.value) >= 0 ||
+                strcmp(current_token.value, node->left->value) == 0) {
+                semantic_error(offset, "%s is reduced twice", current_token.value);
+            }
+            if (loop->reduction_count == MAX_REDUCTIONS) {
+                semantic_error(offset, "too many reduction variables");
+            }
+            loop->ops[loop->reduction_count] = op;
+            strcpy(loop->reductions[loop->reduction_count++], current_token.value);
+            eat(TOKEN_IDENTIFIER);
+
+            if (current_token.type != TOKEN_COMMA) {
+                break;
+            }
+            eat(TOKEN_COMMA);
+        }
+        eat(TOKEN_RPAREN);
+    }
+
+    node->right = parse_block();
+    check_ploop_body(node->right, node, 0, offset);
+    return node;
+}
+
 ASTNode* parse_block(){ //if else
     eat(TOKEN_LBRACE);
 
-    ASTNode* block = create_node(NODE_BLOCK);
     ASTNode* first_stmt = NULL;
     ASTNode* current = NULL;
 
@@ -580,11 +1231,17 @@ ASTNode* parse_block(){ //if else
                 current->next = ret;
             }
 
+            // only a block with a return is a value; the others are
+            // just their statement list
+            ASTNode* block = create_node(NODE_BLOCK);
             block->right = first_stmt;
             eat(TOKEN_RBRACE);
             return block;
         }
 
+        if (current_token.type == TOKEN_SNAPSHOT) {
+            semantic_error(current_token.offset, "snapshot is only allowed at the top level");
+        }
         ASTNode* stmt = parse_statement();
 
         if (first_stmt==NULL) {
@@ -596,7 +1253,6 @@ ASTNode* parse_block(){ //if else
         }
     }
 
-    block->right = first_stmt;
     eat(TOKEN_RBRACE);
     return first_stmt;
 }
@@ -632,13 +1288,629 @@ void set_variable(const char* name, int value) {
     symbol_count++;
 }
 
-// Interpreter
-int interpret_node(ASTNode* node) {
-    if (node == NULL) return 0;
+// Table of variable names used by the static passes
+typedef struct {
+    char (*names)[MAX_TOKEN_LEN];
+    int count;
+    int capacity;
+} NameTable;
+
+int name_index(NameTable* table, const char* name) {
+    for (int i = 0; i < table->count; i++) {
+        if (strcmp(table->names[i], name) == 0) {
+            return i;
+        }
+    }
 
-    switch (node->type) {
-        case NODE_NUMBER:
-            return atoi(node->value);
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity == 0 ? 16 : table->capacity * 2;
+        table->names = realloc(table->names, table->capacity * sizeof(*table->names));
+    }
+    strcpy(table->names[table->count], name);
+    return table->count++;
+}
+
+// Register every variable name used anywhere under a node
+void collect_names(NameTable* table, ASTNode* node) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_VARIABLE) {
+            name_index(table, node->value);
+        }
+        if (node->ploop != NULL) {
+            collect_names(table, node->ploop->start);
+            collect_names(table, node->ploop->end);
+            for (int i = 0; i < node->ploop->reduction_count; i++) {
+                name_index(table, node->ploop->reductions[i]);
+            }
+        }
+        collect_names(table, node->left);
+        collect_names(table, node->right);
+        collect_names(table, node->condition);
+        if (node->cond_chain != NULL) {
+            collect_names(table, node->cond_chain->condition);
+            collect_names(table, node->cond_chain->body);
+        }
+    }
+}
+
+// Register the variables declared under a node
+void collect_declared(NameTable* table, ASTNode* node) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_ASSIGN) {
+            name_index(table, node->left->value);
+        }
+        collect_declared(table, node->left);
+        collect_declared(table, node->right);
+        collect_declared(table, node->condition);
+        if (node->cond_chain != NULL) {
+            collect_declared(table, node->cond_chain->condition);
+            collect_declared(table, node->cond_chain->body);
+        }
+    }
+}
+
+// Static type and range inference
+// Each expression gets the interval of values it can produce (node->lo/hi);
+// values that are provably 0 or 1 are typed TYPE_BOOL. Loops are solved with
+// interval widening, and loop/if conditions narrow the ranges of the
+// variables they compare.
+typedef struct {
+    long long lo;
+    long long hi;
+} Range;
+
+NameTable infer_names;
+
+Range range_make(long long lo, long long hi) {
+    Range r = {lo, hi};
+    return r;
+}
+
+// The empty range is the identity of range_join; it only appears in loop exit states
+Range range_empty() {
+    return range_make(LLONG_MAX, LLONG_MIN);
+}
+
+Range range_join(Range a, Range b) {
+    return range_make(a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi);
+}
+
+// Ranges outside of int wrap around at runtime, so nothing is known about them
+Range range_clamp(Range r) {
+    if (r.lo < INT_MIN || r.hi > INT_MAX) {
+        return range_make(INT_MIN, INT_MAX);
+    }
+    return r;
+}
+
+Range* copy_state(const Range* state) {
+    Range* copy = malloc((infer_names.count > 0 ? infer_names.count : 1) * sizeof(Range));
+    memcpy(copy, state, infer_names.count * sizeof(Range));
+    return copy;
+}
+
+void join_state(Range* into, const Range* other) {
+    for (int i = 0; i < infer_names.count; i++) {
+        into[i] = range_join(into[i], other[i]);
+    }
+}
+
+Range node_range(ASTNode* node) {
+    return range_make(node->lo, node->hi);
+}
+
+Range annotate(ASTNode* node, Range r) {
+    node->lo = r.lo;
+    node->hi = r.hi;
+    node->vtype = (r.lo >= 0 && r.hi <= 1) ? TYPE_BOOL : TYPE_INTEGER;
+    return r;
+}
+
+// Bounds of the exact result of a binop, before any wrap around
+Range binop_bounds(const char* op, Range l, Range r) {
+    if (l.lo > l.hi || r.lo > r.hi) {
+        return range_empty();
+    }
+    switch (op[0]) {
+        case '+':
+            return range_make(l.lo + r.lo, l.hi + r.hi);
+        case '-':
+            return range_make(l.lo - r.hi, l.hi - r.lo);
+        case '*': {
+            long long a = l.lo * r.lo, b = l.lo * r.hi, c = l.hi * r.lo, d = l.hi * r.hi;
+            long long lo = a < b ? a : b, hi = a > b ? a : b;
+            if (c < lo) lo = c;
+            if (c > hi) hi = c;
+            if (d < lo) lo = d;
+            if (d > hi) hi = d;
+            return range_make(lo, hi);
+        }
+        default: {
+            // |l / r| <= |l|; |l % r| < |r| and takes the sign of l
+            long long m = llabs(l.lo) > llabs(l.hi) ? llabs(l.lo) : llabs(l.hi);
+            if (op[0] == '/') {
+                return l.lo >= 0 && r.lo >= 0 ? range_make(0, m) : range_make(-m, m);
+            }
+            long long d = (llabs(r.lo) > llabs(r.hi) ? llabs(r.lo) : llabs(r.hi)) - 1;
+            if (d < m) m = d;
+            if (m < 0) m = 0;
+            return range_make(l.lo < 0 ? -m : 0, l.hi > 0 ? m : 0);
+        }
+    }
+}
+
+// Whether the operand ranges of a binop rule out int overflow
+int binop_fits(ASTNode* node) {
+    Range r = binop_bounds(node->value, node_range(node->left), node_range(node->right));
+    return r.lo >= INT_MIN && r.hi <= INT_MAX;
+}
+
+// Whether a division can neither divide by zero nor overflow
+int divisor_safe(ASTNode* node) {
+    return (node->right->lo > 0 || node->right->hi < 0) &&
+           (node->right->lo > -1 || node->right->hi < -1 || node->left->lo > INT_MIN);
+}
+
+// Intersect a variable's range with a bound; an empty result is left alone
+// since the state is only ever used as an over-approximation
+void narrow_variable(ASTNode* var, Range* state, long long lo, long long hi) {
+    Range* r = &state[name_index(&infer_names, var->value)];
+    if (lo < r->lo) lo = r->lo;
+    if (hi > r->hi) hi = r->hi;
+    if (lo <= hi) {
+        *r = range_make(lo, hi);
+    }
+}
+
+// Narrow `var op other` assuming the comparison has the given truth value
+void narrow_compare(ASTNode* var, const char* op, Range other, int truth, Range* state) {
+    if (strcmp(op, "!=") == 0) {
+        op = "==";
+        truth = !truth;
+    }
+
+    if (strcmp(op, "==") == 0) {
+        if (truth) narrow_variable(var, state, other.lo, other.hi);
+    } else if (strcmp(op, "<") == 0) {
+        if (truth) narrow_variable(var, state, INT_MIN, other.hi - 1);
+        else narrow_variable(var, state, other.lo, INT_MAX);
+    } else if (strcmp(op, ">") == 0) {
+        if (truth) narrow_variable(var, state, other.lo + 1, INT_MAX);
+        else narrow_variable(var, state, INT_MIN, other.hi);
+    } else if (strcmp(op, "<=") == 0) {
+        if (truth) narrow_variable(var, state, INT_MIN, other.hi);
+        else narrow_variable(var, state, other.lo + 1, INT_MAX);
+    } else if (strcmp(op, ">=") == 0) {
+        if (truth) narrow_variable(var, state, other.lo, INT_MAX);
+        else narrow_variable(var, state, INT_MIN, other.hi - 1);
+    }
+}
+
+// Narrow the state assuming a condition evaluated to the given truth value.
+// A comparison only says something about a variable's value when it was
+// read, so variables the condition itself writes (in a block operand) are
+// left alone.
+void narrow_operand(ASTNode* whole, ASTNode* cond, Range* state, int truth) {
+    switch (cond->type) {
+        case NODE_VARIABLE:
+            if (!truth && !writes(whole, cond->value)) narrow_variable(cond, state, 0, 0);
+            return;
+
+        case NODE_COMPARE: {
+            const char* mirrored = cond->value;
+            if (strcmp(cond->value, "<") == 0) mirrored = ">";
+            else if (strcmp(cond->value, ">") == 0) mirrored = "<";
+            else if (strcmp(cond->value, "<=") == 0) mirrored = ">=";
+            else if (strcmp(cond->value, ">=") == 0) mirrored = "<=";
+
+            if (cond->left->type == NODE_VARIABLE && !writes(whole, cond->left->value)) {
+                narrow_compare(cond->left, cond->value, node_range(cond->right), truth, state);
+            }
+            if (cond->right->type == NODE_VARIABLE && !writes(whole, cond->right->value)) {
+                narrow_compare(cond->right, mirrored, node_range(cond->left), truth, state);
+            }
+            return;
+        }
+
+        case NODE_LOGIC:
+            if (strcmp(cond->value, "!") == 0) {
+                narrow_operand(whole, cond->right, state, !truth);
+            } else if ((strcmp(cond->value, "&") == 0 && truth) ||
+                       (strcmp(cond->value, "|") == 0 && !truth)) {
+                narrow_operand(whole, cond->left, state, truth);
+                narrow_operand(whole, cond->right, state, truth);
+            }
+            return;
+
+        default:
+            return;
+    }
+}
+
+void narrow_condition(ASTNode* cond, Range* state, int truth) {
+    narrow_operand(cond, cond, state, truth);
+}
+
+Range infer_node(ASTNode* node, Range* state);
+
+// Infer a statement list; in a loop body, states that may leave the loop are
+// joined into exit_state. Returns 0 when the end of the list is unreachable.
+int infer_chain(ASTNode* stmt, Range* state, Range* exit_state) {
+    for (; stmt != NULL; stmt = stmt->next) {
+        if (exit_state != NULL && stmt->type == NODE_BREAK) {
+            annotate(stmt, range_make(-999999, -999999));
+            join_state(exit_state, state);
+            return 0;
+        }
+
+        Range r = infer_node(stmt, state);
+        if (exit_state != NULL && stmt->type != NODE_IF_STMT && stmt->type != NODE_LOOP &&
+            r.lo <= -999999 && r.hi >= -999999) {
+            join_state(exit_state, state);
+        }
+    }
+    return 1;
+}
+
+Range infer_node(ASTNode* node, Range* state) {
+    switch (node->type) {
+        case NODE_NUMBER: {
+            int value = atoi(node->value);
+            return annotate(node, range_make(value, value));
+        }
+
+        case NODE_VARIABLE:
+            return annotate(node, state[name_index(&infer_names, node->value)]);
+
+        case NODE_ASSIGN:
+        case NODE_REASSIGN: {
+            Range r = infer_node(node->right, state);
+            // a max/min reduction keeps the larger/smaller value
+            state[name_index(&infer_names, node->left->value)] =
+                node->fold != REDUCE_NONE ? range_make(INT_MIN, INT_MAX) : r;
+            return annotate(node, r);
+        }
+
+        case NODE_PRINT:
+        case NODE_RETURN:
+            return annotate(node, infer_node(node->right, state));
+
+        case NODE_LOGIC: {
+            if (strcmp(node->value, "!") == 0) {
+                Range r = infer_node(node->right, state);
+                if (r.lo > 0 || r.hi < 0) return annotate(node, range_make(0, 0));
+                if (r.lo == 0 && r.hi == 0) return annotate(node, range_make(1, 1));
+                return annotate(node, range_make(0, 1));
+            }
+
+            infer_node(node->left, state);
+            infer_node(node->right, state);
+            return annotate(node, range_make(0, 1));
+        }
+
+        case NODE_BINOP: {
+            Range l = infer_node(node->left, state);
+            Range r = infer_node(node->right, state);
+            return annotate(node, range_clamp(binop_bounds(node->value, l, r)));
+        }
+
+        case NODE_COMPARE: {
+            Range l = infer_node(node->left, state);
+            Range r = infer_node(node->right, state);
+            int always = 0, never = 0;
+            if (strcmp(node->value, "<") == 0) {
+                always = l.hi < r.lo;
+                never = l.lo >= r.hi;
+            } else if (strcmp(node->value, ">") == 0) {
+                always = l.lo > r.hi;
+                never = l.hi <= r.lo;
+            } else if (strcmp(node->value, "<=") == 0) {
+                always = l.hi <= r.lo;
+                never = l.lo > r.hi;
+            } else if (strcmp(node->value, ">=") == 0) {
+                always = l.lo >= r.hi;
+                never = l.hi < r.lo;
+            } else {
+                int equal = l.lo == l.hi && r.lo == r.hi && l.lo == r.lo;
+                int disjoint = l.hi < r.lo || r.hi < l.lo;
+                always = strcmp(node->value, "==") == 0 ? equal : disjoint;
+                never = strcmp(node->value, "==") == 0 ? disjoint : equal;
+            }
+            return annotate(node, range_make(always ? 1 : 0, never ? 0 : 1));
+        }
+
+        case NODE_IF_STMT: {
+            ConditionalBranch* branch = node->cond_chain;
+            Range c = infer_node(branch->condition, state);
+
+            if (c.lo != 0 || c.hi != 0) {
+                Range* body_state = copy_state(state);
+                narrow_condition(branch->condition, body_state, 1);
+                infer_chain(branch->body, body_state, NULL);
+
+                if (c.lo > 0 || c.hi < 0) {
+                    memcpy(state, body_state, infer_names.count * sizeof(Range));
+                } else {
+                    narrow_condition(branch->condition, state, 0);
+                    join_state(state, body_state);
+                }
+                free(body_state);
+            }
+            return annotate(node, range_make(0, 0));
+        }
+
+        case NODE_BLOCK: {
+            Range r = range_make(0, 0);
+            for (ASTNode* stmt = node->right; stmt != NULL; stmt = stmt->next) {
+                r = infer_node(stmt, state);
+            }
+            return annotate(node, r);
+        }
+
+        case NODE_LOOP: {
+            Range* entry = copy_state(state);
+            Range* exit_state = copy_state(state);
+
+            while (1) {
+                memcpy(state, entry, infer_names.count * sizeof(Range));
+                for (int i = 0; i < infer_names.count; i++) {
+                    exit_state[i] = range_empty();
+                }
+
+                if (node->condition != NULL) {
+                    Range c = infer_node(node->condition, state);
+                    Range* done = copy_state(state);
+                    narrow_condition(node->condition, done, 0);
+                    join_state(exit_state, done);
+                    free(done);
+                    if (c.lo == 0 && c.hi == 0) {
+                        break;
+                    }
+                    narrow_condition(node->condition, state, 1);
+                }
+
+                if (!infer_chain(node->right, state, exit_state)) {
+                    break;
+                }
+
+                // back edge: widen every bound that is still growing
+                int stable = 1;
+                for (int i = 0; i < infer_names.count; i++) {
+                    if (state[i].lo < entry[i].lo) {
+                        entry[i].lo = INT_MIN;
+                        stable = 0;
+                    }
+                    if (state[i].hi > entry[i].hi) {
+                        entry[i].hi = INT_MAX;
+                        stable = 0;
+                    }
+                }
+                if (stable) {
+                    break;
+                }
+            }
+
+            // a loop that never exits leaves nothing known after it
+            for (int i = 0; i < infer_names.count; i++) {
+                state[i] = exit_state[i].lo > exit_state[i].hi ? range_make(INT_MIN, INT_MAX)
+                                                               : exit_state[i];
+            }
+            free(entry);
+            free(exit_state);
+            return annotate(node, range_make(0, 0));
+        }
+
+        case NODE_BREAK:
+            return annotate(node, range_make(-999999, -999999));
+
+        case NODE_SNAPSHOT:
+            return annotate(node, range_make(0, 0));
+
+        case NODE_PLOOP: {
+            // the body writes nothing but its reductions, which are left
+            // unknown, so a single pass over it is already a fixpoint
+            ParallelLoop* loop = node->ploop;
+            Range start = infer_node(loop->start, state);
+            Range end = infer_node(loop->end, state);
+
+            Range* body_state = copy_state(state);
+            for (int i = 0; i < loop->reduction_count; i++) {
+                int var = name_index(&infer_names, loop->reductions[i]);
+                body_state[var] = state[var] = range_make(INT_MIN, INT_MAX);
+            }
+            if (start.lo <= end.hi - 1) {
+                body_state[name_index(&infer_names, node->left->value)] = range_make(start.lo, end.hi - 1);
+            }
+            infer_chain(node->right, body_state, NULL);
+            free(body_state);
+            return annotate(node, range_make(0, 0));
+        }
+    }
+
+    return annotate(node, range_make(INT_MIN, INT_MAX));
+}
+
+// Annotate a list of statements; variables start with the range of their
+// current value in the symbol table, or unknown when they are not declared yet
+void infer_program(ASTNode* program) {
+    infer_names.count = 0;
+    collect_names(&infer_names, program);
+
+    Range* state = malloc((infer_names.count > 0 ? infer_names.count : 1) * sizeof(Range));
+    for (int i = 0; i < infer_names.count; i++) {
+        state[i] = range_make(INT_MIN, INT_MAX);
+        for (int j = 0; j < symbol_count; j++) {
+            if (strcmp(symbol_table[j].name, infer_names.names[i]) == 0) {
+                state[i] = range_make(symbol_table[j].value, symbol_table[j].value);
+                break;
+            }
+        }
+    }
+
+    infer_chain(program, state, NULL);
+    free(state);
+}
+
+// Memoization of pure value blocks
+// A block inside a loop that only reads variables (no print, no declarations
+// or assignments, since every variable is global) is cached by the values of
+// the variables it reads, in a small direct-mapped table.
+#define BLOCK_CACHE_SIZE 64
+
+typedef struct BlockCache {
+    NameTable reads;    // variables the block reads
+    int* slots;         // their symbol table indices, -1 until resolved
+    int* key;           // values of the reads for the current lookup
+    int* keys;          // BLOCK_CACHE_SIZE rows of reads.count values
+    int* results;
+    char* valid;
+    long long bytes;    // charged to the memory budget
+} BlockCache;
+
+int memo_blocks = 0;
+long memo_hits = 0;
+long memo_misses = 0;
+
+int is_pure(ASTNode* node) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_PRINT || node->type == NODE_ASSIGN || node->type == NODE_REASSIGN ||
+            node->type == NODE_PLOOP) {
+            return 0;
+        }
+        if (!is_pure(node->left) || !is_pure(node->right) || !is_pure(node->condition)) {
+            return 0;
+        }
+        if (node->cond_chain != NULL &&
+            (!is_pure(node->cond_chain->condition) || !is_pure(node->cond_chain->body))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+BlockCache* create_block_cache(ASTNode* block) {
+    BlockCache* cache = malloc(sizeof(BlockCache));
+    cache->reads.names = NULL;
+    cache->reads.count = 0;
+    cache->reads.capacity = 0;
+    collect_names(&cache->reads, block->right);
+
+    int n = cache->reads.count > 0 ? cache->reads.count : 1;
+    cache->bytes = sizeof(BlockCache) + cache->reads.capacity * sizeof(*cache->reads.names) +
+                   (2 + BLOCK_CACHE_SIZE) * n * sizeof(int) + BLOCK_CACHE_SIZE * (sizeof(int) + 1);
+    budget_charge(cache->bytes);
+    cache->slots = malloc(n * sizeof(int));
+    for (int i = 0; i < cache->reads.count; i++) {
+        cache->slots[i] = -1;
+    }
+    cache->key = malloc(n * sizeof(int));
+    cache->keys = malloc(BLOCK_CACHE_SIZE * n * sizeof(int));
+    cache->results = malloc(BLOCK_CACHE_SIZE * sizeof(int));
+    cache->valid = calloc(BLOCK_CACHE_SIZE, 1);
+    memo_blocks++;
+    return cache;
+}
+
+void free_block_cache(BlockCache* cache) {
+    budget_release(cache->bytes);
+    free(cache->reads.names);
+    free(cache->slots);
+    free(cache->key);
+    free(cache->keys);
+    free(cache->results);
+    free(cache->valid);
+    free(cache);
+}
+
+// Attach caches to the pure blocks that are evaluated repeatedly. ploop
+// bodies run on several threads at once and are left alone.
+void memoize_blocks(ASTNode* node, int in_loop) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_PLOOP) {
+            continue;
+        }
+        if (node->type == NODE_BLOCK && in_loop && is_pure(node->right)) {
+            if (node->cache == NULL) {
+                node->cache = create_block_cache(node);
+            }
+            continue;
+        }
+
+        int inner = in_loop || node->type == NODE_LOOP;
+        memoize_blocks(node->left, inner);
+        memoize_blocks(node->right, inner);
+        memoize_blocks(node->condition, inner);
+        if (node->cond_chain != NULL) {
+            memoize_blocks(node->cond_chain->condition, inner);
+            memoize_blocks(node->cond_chain->body, inner);
+        }
+    }
+}
+
+// Look up the cached result of a block. On a miss, *slot is the row to fill
+// with memo_store, or -1 when a read variable is not declared yet (the block
+// is then evaluated normally so it reports the error itself).
+int memo_lookup(BlockCache* cache, int* result, int* slot) {
+    unsigned hash = 2166136261u;
+    int n = cache->reads.count;
+
+    for (int i = 0; i < n; i++) {
+        if (cache->slots[i] < 0) {
+            for (int j = 0; j < symbol_count; j++) {
+                if (strcmp(symbol_table[j].name, cache->reads.names[i]) == 0) {
+                    cache->slots[i] = j;
+                    break;
+                }
+            }
+            if (cache->slots[i] < 0) {
+                *slot = -1;
+                return 0;
+            }
+        }
+        cache->key[i] = symbol_table[cache->slots[i]].value;
+        hash = (hash ^ (unsigned)cache->key[i]) * 16777619u;
+    }
+
+    *slot = hash % BLOCK_CACHE_SIZE;
+    if (cache->valid[*slot] &&
+        memcmp(&cache->keys[*slot * n], cache->key, n * sizeof(int)) == 0) {
+        memo_hits++;
+        *result = cache->results[*slot];
+        return 1;
+    }
+    memo_misses++;
+    return 0;
+}
+
+void memo_store(BlockCache* cache, int slot, int result) {
+    int n = cache->reads.count;
+    memcpy(&cache->keys[slot * n], cache->key, n * sizeof(int));
+    cache->results[slot] = result;
+    cache->valid[slot] = 1;
+}
+
+int run_ploop(ASTNode* node);
+
+// Integer division and remainder; INT_MIN / -1 wraps like + and - do
+int divide(int left, int right, int remainder) {
+    if (right == 0) {
+        fprintf(stderr, "division by zero\n");
+        exit(1);
+    }
+    if (right == -1) {
+        return remainder ? 0 : (int)(0u - (unsigned)left);
+    }
+    return remainder ? left % right : left / right;
+}
+int reduce_combine(ReduceOp op, int a, int b);
+
+// Interpreter
+int interpret_node(ASTNode* node) {
+    if (node == NULL) return 0;
+
+    switch (node->type) {
+        case NODE_NUMBER:
+            return atoi(node->value);
 
         case NODE_VARIABLE:
             return get_variable(node->value);
@@ -660,12 +1932,20 @@ int interpret_node(ASTNode* node) {
         case NODE_LOGIC: {
             if (strcmp(node->value, "!")==0){
                 int right_val = interpret_node(node->right);
+                if (node->right->vtype == TYPE_BOOL) {
+                    return right_val ^ 1;
+                }
                 return right_val==0? 1:0;
             }
 
             int left = interpret_node(node->left);
             int right = interpret_node(node->right);
 
+            // known booleans need no normalization
+            if (node->left->vtype == TYPE_BOOL && node->right->vtype == TYPE_BOOL) {
+                return node->value[0] == '&' ? (left & right) : (left | right);
+            }
+
             if (strcmp(node->value, "&")==0){
                 return (left != 0 && right != 0) ? 1:0;
             } else if (strcmp(node->value, "|")==0){
@@ -691,7 +1971,13 @@ int interpret_node(ASTNode* node) {
                 exit(1);
             }
             int value = interpret_node(node->right);
-            set_variable(name, value);
+            if (node->fold != REDUCE_NONE) {
+                // max/min reduction in a ploop body
+                int current = get_variable(name);
+                set_variable(name, reduce_combine(node->fold, current, value));
+            } else {
+                set_variable(name, value);
+            }
             return value;
         }
 
@@ -705,10 +1991,12 @@ int interpret_node(ASTNode* node) {
             int left_val = interpret_node(node->left);
             int right_val = interpret_node(node->right);
 
-            if (strcmp(node->value, "+")==0){
-                return left_val + right_val;
-            } else if (strcmp(node->value, "-")==0){
-                return left_val - right_val;
+            switch (node->value[0]) {
+                case '+': return left_val + right_val;
+                case '-': return left_val - right_val;
+                case '*': return (int)((unsigned)left_val * (unsigned)right_val);
+                case '/': return divide(left_val, right_val, 0);
+                case '%': return divide(left_val, right_val, 1);
             }
 
             fprintf(stderr, "unknown operator: %s\n", node->value);
@@ -728,6 +2016,10 @@ int interpret_node(ASTNode* node) {
                 return left_val>right_val ? 1:0;
             } else if(strcmp(node->value, "!=")==0){
                 return left_val!=right_val ? 1:0;
+            } else if(strcmp(node->value, "<=")==0){
+                return left_val<=right_val ? 1:0;
+            } else if(strcmp(node->value, ">=")==0){
+                return left_val>=right_val ? 1:0;
             }
 
             fprintf(stderr, "unknown comparison operator: %s\n", node->value);
@@ -748,17 +2040,24 @@ int interpret_node(ASTNode* node) {
         }
 
         case NODE_BLOCK: {
-            ASTNode* stmt = node->right;
+            int slot = -1;
             int last_value = 0;
+            if (node->cache != NULL && memo_lookup(node->cache, &last_value, &slot)) {
+                return last_value;
+            }
 
+            ASTNode* stmt = node->right;
             while (stmt != NULL){
                 last_value = interpret_node(stmt);
                 if (stmt->type == NODE_RETURN) {
-                    return last_value;
+                    break;
                 }
                 stmt = stmt->next;
             }
 
+            if (slot >= 0) {
+                memo_store(node->cache, slot, last_value);
+            }
             return last_value;
         }
 
@@ -767,7 +2066,15 @@ int interpret_node(ASTNode* node) {
         }
 
         case NODE_LOOP: {
+            // fuel for one iteration: the condition and each body statement
+            long long cost = 1;
+            for (ASTNode* stmt = node->right; stmt != NULL; stmt = stmt->next) {
+                cost++;
+            }
+
             while (1) {
+                spend_fuel(cost);
+
                 if (node->condition != NULL){
                     if (interpret_node(node->condition)==0){
                         break;
@@ -790,61 +2097,1067 @@ int interpret_node(ASTNode* node) {
         case NODE_BREAK: {
             return -999999;
         }
+
+        case NODE_PLOOP:
+            return run_ploop(node);
+
+        case NODE_SNAPSHOT:
+            // taken by the top-level loop when --snapshot is given
+            return 0;
     }
 
     return 0;  // To satisfy compiler
 }
 
-// Main interpreter function
-void interpret(const char* input) {
-    clock_t start = clock();
-    // Initialize interpreter
-    source = (char*)input;
-    pos = 0;
-    line = 1;
-    column = 1;
-    symbol_count = 0;
+// Thread pool for the parallel front end
+// pool_run runs a task on every pool thread at once, the caller being worker 0.
+#define MAX_POOL_THREADS 256
+
+int pool_threads = 1;
+int pool_started = 0;
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+void (*pool_task)(void* arg, int worker);
+void* pool_arg;
+long pool_generation = 0;
+int pool_pending = 0;
+
+void* pool_worker_main(void* arg) {
+    int worker = (int)(long)arg;
+    long seen = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+        while (pool_generation == seen) {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        seen = pool_generation;
+        void (*task)(void*, int) = pool_task;
+        void* task_arg = pool_arg;
+        pthread_mutex_unlock(&pool_lock);
 
-    // Get first token
-    current_token = get_next_token();
+        task(task_arg, worker);
 
-    // Parse and interpret until EOF
-    while (current_token.type != TOKEN_EOF) {
-        ASTNode* node = parse_statement();
-        interpret_node(node);
-        free_ast(node);
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_pending == 0) {
+            pthread_cond_signal(&pool_done);
+        }
     }
-
-    clock_t end = clock();
-    double cpu_time_used = ((double)(end-start))/CLOCKS_PER_SEC;
-    printf("execution time: %f seconds\n", cpu_time_used);
+    return NULL;
 }
 
-char* read_pavo_file(const char* filename){
-    const char* extension = strrchr(filename, '.');
-    if (extension==NULL || strcmp(extension, "pavo")==0){
-        fprintf(stderr, "error: the file extension .pavo\n");
-        return NULL;
+void pool_run(void (*task)(void* arg, int worker), void* arg) {
+    if (!pool_started) {
+        for (int i = 1; i < pool_threads; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, pool_worker_main, (void*)(long)i) != 0) {
+                fprintf(stderr, "error: could not start worker thread\n");
+                exit(1);
+            }
+            pthread_detach(thread);
+        }
+        pool_started = 1;
     }
 
-    FILE* file = fopen(filename, "r");
-    if (file==NULL){
-        fprintf(stderr, "error: could not open '%s'\n", filename);
-        return NULL;
-    }
+    pthread_mutex_lock(&pool_lock);
+    pool_task = task;
+    pool_arg = arg;
+    pool_pending = pool_threads - 1;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    task(arg, 0);
 
-    char* buffer = (char *)malloc(file_size + 1);
-    if (buffer==NULL){
-        fprintf(stderr, "error: could not allocate memory for the file\n");
-        fclose(file);
-        return NULL;
+    pthread_mutex_lock(&pool_lock);
+    while (pool_pending > 0) {
+        pthread_cond_wait(&pool_done, &pool_lock);
     }
+    pthread_mutex_unlock(&pool_lock);
+}
 
-    size_t bytes_read = fread(buffer, 1, file_size, file);
+// Parallel loops
+// The iterations are split into one range per pool thread. A thread takes
+// small grains from the front of its own range and, once that is empty,
+// steals the upper half of another thread's range. Each thread runs on a
+// private copy of the symbol table in which the reduction variables start at
+// the identity of their operator; the partial results are combined at the end.
+typedef struct {
+    pthread_mutex_t lock;
+    long long next;
+    long long end;
+} WorkRange;
+
+typedef struct {
+    ASTNode* node;
+    Symbol* symbols;            // symbol table at the start of the loop
+    int symbol_count;
+    int loop_slot;
+    int reduction_slots[MAX_REDUCTIONS];
+    WorkRange* ranges;
+    int workers;
+    long long grain;
+    int* partials;              // MAX_REDUCTIONS values per worker
+    long long* iterations;      // per worker
+    atomic_llong fuel;          // left for loops in the body, shared by the workers
+} ParallelJob;
+
+// Cover a negative fuel_left from the shared pool of a ploop, if any. Slices
+// shrink as the pool drains, so that little is left stranded in other
+// workers when it runs out.
+void refill_fuel() {
+    while (fuel_left < 0) {
+        long long available = fuel_pool != NULL ? atomic_load(fuel_pool) : 0;
+        long long take;
+        do {
+            take = available / (2 * pool_threads);
+            if (take > FUEL_SLICE) {
+                take = FUEL_SLICE;
+            } else if (take < 1) {
+                take = available;
+            }
+            if (take <= 0) {
+                out_of_fuel();
+            }
+        } while (!atomic_compare_exchange_weak(fuel_pool, &available, available - take));
+        fuel_left += take;
+    }
+}
+
+int reduce_identity(ReduceOp op) {
+    switch (op) {
+        case REDUCE_AND: return 1;
+        case REDUCE_MAX: return INT_MIN;
+        case REDUCE_MIN: return INT_MAX;
+        default: return 0;
+    }
+}
+
+int reduce_combine(ReduceOp op, int a, int b) {
+    switch (op) {
+        case REDUCE_ADD: return (int)((unsigned)a + (unsigned)b);
+        case REDUCE_AND: return (a != 0 && b != 0) ? 1:0;
+        case REDUCE_OR: return (a != 0 || b != 0) ? 1:0;
+        case REDUCE_MAX: return a > b ? a : b;
+        case REDUCE_MIN: return a < b ? a : b;
+        case REDUCE_NONE: break;
+    }
+    return a;
+}
+
+// Take the next grain from the front of a range; returns 0 when it is empty
+int take_work(WorkRange* range, long long grain, long long* first, long long* last) {
+    pthread_mutex_lock(&range->lock);
+    long long count = range->end - range->next;
+    if (count > grain) {
+        count = grain;
+    }
+    *first = range->next;
+    range->next += count;
+    *last = range->next;
+    pthread_mutex_unlock(&range->lock);
+    return count > 0;
+}
+
+// Refill an empty range with the upper half of another one
+int steal_work(ParallelJob* job, int worker) {
+    for (int i = 1; i < job->workers; i++) {
+        WorkRange* victim = &job->ranges[(worker + i) % job->workers];
+        pthread_mutex_lock(&victim->lock);
+        long long count = victim->end - victim->next;
+        if (count > job->grain) {
+            long long middle = victim->next + count / 2;
+            long long end = victim->end;
+            victim->end = middle;
+            pthread_mutex_unlock(&victim->lock);
+
+            WorkRange* own = &job->ranges[worker];
+            pthread_mutex_lock(&own->lock);
+            own->next = middle;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return 0;
+}
+
+void ploop_task(void* arg, int worker) {
+    ParallelJob* job = arg;
+    ParallelLoop* loop = job->node->ploop;
+
+    memcpy(symbol_table, job->symbols, job->symbol_count * sizeof(Symbol));
+    symbol_count = job->symbol_count;
+    for (int i = 0; i < loop->reduction_count; i++) {
+        symbol_table[job->reduction_slots[i]].value = reduce_identity(loop->ops[i]);
+    }
+    fuel_left = 0;
+    fuel_pool = &job->fuel;
+
+    long long first, last;
+    long long done = 0;
+    while (1) {
+        if (!take_work(&job->ranges[worker], job->grain, &first, &last)) {
+            if (!steal_work(job, worker)) {
+                break;
+            }
+            continue;
+        }
+
+        for (long long i = first; i < last; i++) {
+            symbol_count = job->symbol_count;   // drop the previous iteration's variables
+            symbol_table[job->loop_slot].value = (int)i;
+            for (ASTNode* stmt = job->node->right; stmt != NULL; stmt = stmt->next) {
+                interpret_node(stmt);
+            }
+        }
+        done += last - first;
+    }
+
+    for (int i = 0; i < loop->reduction_count; i++) {
+        job->partials[worker * MAX_REDUCTIONS + i] = symbol_table[job->reduction_slots[i]].value;
+    }
+    job->iterations[worker] = done;
+    atomic_fetch_add(&job->fuel, fuel_left);
+    fuel_pool = NULL;
+}
+
+int run_ploop(ASTNode* node) {
+    ParallelLoop* loop = node->ploop;
+    long long start = interpret_node(loop->start);
+    long long end = interpret_node(loop->end);
+
+    ParallelJob job;
+    int values[MAX_REDUCTIONS];
+    for (int i = 0; i < loop->reduction_count; i++) {
+        values[i] = get_variable(loop->reductions[i]);
+        for (int j = 0; j < symbol_count; j++) {
+            if (strcmp(symbol_table[j].name, loop->reductions[i]) == 0) {
+                job.reduction_slots[i] = j;
+            }
+        }
+    }
+    if (start >= end) {
+        return 0;
+    }
+
+    // a let in the body declares a variable private to each iteration, so
+    // the name cannot also be a variable of the enclosing program: writes
+    // to it in the body would otherwise be silently dropped
+    NameTable private = {0};
+    collect_declared(&private, node->right);
+    for (int i = 0; i < private.count; i++) {
+        for (int j = 0; j < symbol_count; j++) {
+            if (strcmp(symbol_table[j].name, private.names[i]) == 0) {
+                fprintf(stderr, "var %s is declared already\n", private.names[i]);
+                exit(1);
+            }
+        }
+    }
+    free(private.names);
+
+    // every iteration is a back edge; loops in the body charge their own fuel
+    long long cost = 1;
+    for (ASTNode* stmt = node->right; stmt != NULL; stmt = stmt->next) {
+        cost++;
+    }
+#ifndef PAVO_NO_BUDGETS
+    if (end - start > fuel_left / cost) {
+        fuel_left = -1;
+        out_of_fuel();
+    }
+    fuel_left -= (end - start) * cost;
+#endif
+
+    // the loop variable is private: add it to the copied table if needed
+    int saved_count = symbol_count;
+    job.node = node;
+    job.symbols = malloc((symbol_count + 1) * sizeof(Symbol));
+    memcpy(job.symbols, symbol_table, symbol_count * sizeof(Symbol));
+    job.symbol_count = symbol_count;
+    job.loop_slot = -1;
+    for (int j = 0; j < symbol_count; j++) {
+        if (strcmp(symbol_table[j].name, node->left->value) == 0) {
+            job.loop_slot = j;
+        }
+    }
+    if (job.loop_slot < 0) {
+        if (symbol_count >= MAX_IDENTIFIERS) {
+            fprintf(stderr, "Too many variables\n");
+            exit(1);
+        }
+        job.loop_slot = job.symbol_count++;
+        strcpy(job.symbols[job.loop_slot].name, node->left->value);
+        job.symbols[job.loop_slot].type = TYPE_INTEGER;
+    }
+
+    job.workers = (pool_threads > 1 && end - start >= 2 * pool_threads) ? pool_threads : 1;
+    job.grain = (end - start) / (job.workers * 64);
+    if (job.grain < 1) {
+        job.grain = 1;
+    }
+    job.ranges = malloc(job.workers * sizeof(WorkRange));
+    job.partials = malloc(job.workers * MAX_REDUCTIONS * sizeof(int));
+    job.iterations = malloc(job.workers * sizeof(long long));
+    atomic_init(&job.fuel, fuel_left);
+    for (int w = 0; w < job.workers; w++) {
+        pthread_mutex_init(&job.ranges[w].lock, NULL);
+        job.ranges[w].next = start + (end - start) * w / job.workers;
+        job.ranges[w].end = start + (end - start) * (w + 1) / job.workers;
+        job.iterations[w] = 0;
+    }
+
+    if (job.workers > 1) {
+        pool_run(ploop_task, &job);
+    } else {
+        ploop_task(&job, 0);
+    }
+
+    // this thread was worker 0: put its own table back, then combine
+    memcpy(symbol_table, job.symbols, saved_count * sizeof(Symbol));
+    symbol_count = saved_count;
+    fuel_left = atomic_load(&job.fuel);
+    for (int w = 0; w < job.workers; w++) {
+        if (job.iterations[w] == 0) {
+            continue;
+        }
+        for (int i = 0; i < loop->reduction_count; i++) {
+            values[i] = reduce_combine(loop->ops[i], values[i], job.partials[w * MAX_REDUCTIONS + i]);
+        }
+    }
+    for (int i = 0; i < loop->reduction_count; i++) {
+        symbol_table[job.reduction_slots[i]].value = values[i];
+    }
+
+    for (int w = 0; w < job.workers; w++) {
+        pthread_mutex_destroy(&job.ranges[w].lock);
+    }
+    free(job.symbols);
+    free(job.ranges);
+    free(job.partials);
+    free(job.iterations);
+    return 0;
+}
+
+// Parallel front end
+// Large sources are cut at top-level statement boundaries found by a quick
+// pre-scan, and each window of chunks is lexed and parsed on the thread pool.
+// A chunk that fails to parse (a syntax error, or a cut the pre-scan got
+// wrong) is left to the serial front end, so errors match it exactly.
+// Windows are kept small so that their nodes are still in cache when the
+// statements are run and freed.
+#ifndef PARALLEL_PARSE_MIN
+#define PARALLEL_PARSE_MIN (1 << 20)
+#endif
+#ifndef PARSE_CHUNK_SIZE
+#define PARSE_CHUNK_SIZE (16 * 1024)
+#endif
+#ifndef PARSE_CHUNKS_PER_THREAD
+#define PARSE_CHUNKS_PER_THREAD 2
+#endif
+
+typedef struct {
+    int start;
+    int end;
+    ASTNode* first;
+    int ok;
+    long long memory;   // allocated by the worker, charged to the main thread
+} ParseChunk;
+
+typedef struct {
+    const char* input;
+    ParseChunk* chunks;
+    int count;
+    atomic_int next;
+} ParseWindow;
+
+// Skip whitespace and comments in the pre-scan
+int prescan_skip(const char* input, int len, int p) {
+    while (p < len) {
+        if (input[p] == '#') {
+            const char* newline = memchr(input + p, '\n', len - p);
+            p = newline != NULL ? (int)(newline - input) : len;
+        } else if (isspace(input[p])) {
+            p++;
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+// End of the chunk starting at start: the first top-level statement boundary
+// (a `;` or a closing `}` at brace depth 0) PARSE_CHUNK_SIZE bytes in
+int chunk_end(const char* input, int len, int start) {
+    int depth = 0;
+    int p = start;
+
+    source = (char*)input;
+    source_len = len;
+    while (p < len) {
+        p = scan_plain(p);
+        if (p >= len) {
+            break;
+        }
+
+        char c = input[p];
+        if (c == '#') {
+            p = prescan_skip(input, len, p);
+            continue;
+        }
+
+        p++;
+        if (c == '{') {
+            depth++;
+        } else if (c == ';' && depth == 0) {
+            if (p - start >= PARSE_CHUNK_SIZE) {
+                return p;
+            }
+        } else if (c == '}') {
+            if (depth > 0) {
+                depth--;
+            }
+            // `let k := { ... };` still continues with its `;`
+            if (depth == 0 && p - start >= PARSE_CHUNK_SIZE &&
+                input[prescan_skip(input, len, p)] != ';') {
+                return p;
+            }
+        }
+    }
+    return len;
+}
+
+void parse_chunk(const char* input, ParseChunk* chunk) {
+    jmp_buf recovery;
+    long long saved_memory = memory_used;
+
+    memory_used = 0;
+    chunk->first = NULL;
+    chunk->ok = 0;
+    source = (char*)input;
+    source_len = chunk->end;
+    pos = chunk->start;
+
+    parse_recovery = &recovery;
+    if (setjmp(recovery) == 0) {
+        ASTNode* current = NULL;
+        current_token = get_next_token();
+        while (current_token.type != TOKEN_EOF) {
+            parse_pending_count = 0;
+            ASTNode* stmt = parse_statement();
+            if (chunk->first == NULL) {
+                chunk->first = stmt;
+            } else {
+                current->next = stmt;
+            }
+            current = stmt;
+        }
+        chunk->ok = 1;
+    } else {
+        free_pending();
+    }
+    parse_recovery = NULL;
+    parse_pending_count = 0;
+
+    chunk->memory = memory_used;
+    memory_used = saved_memory;
+}
+
+void parse_window_task(void* arg, int worker) {
+    (void)worker;
+    ParseWindow* window = arg;
+    int i;
+    while ((i = atomic_fetch_add(&window->next, 1)) < window->count) {
+        parse_chunk(window->input, &window->chunks[i]);
+    }
+}
+
+// Parse the next window of statements from *offset on the thread pool and
+// return them as one list in source order. *offset moves past the parsed
+// statements; it stops at the start of a chunk that failed, and *failed is set.
+ASTNode* parse_window(const char* input, int len, int* offset, int* failed) {
+    // --jobs is not bounded, so the chunks live on the heap
+    ParseChunk* chunks = malloc(PARSE_CHUNKS_PER_THREAD * pool_threads * sizeof(ParseChunk));
+    ParseWindow window;
+
+    window.input = input;
+    window.chunks = chunks;
+    window.count = 0;
+    atomic_init(&window.next, 0);
+    for (int start = *offset; start < len && window.count < PARSE_CHUNKS_PER_THREAD * pool_threads;
+         window.count++) {
+        chunks[window.count].start = start;
+        chunks[window.count].end = start = chunk_end(input, len, start);
+    }
+
+    pool_run(parse_window_task, &window);
+
+    ASTNode* first = NULL;
+    ASTNode* last = NULL;
+    *failed = 0;
+    for (int i = 0; i < window.count; i++) {
+        budget_charge(chunks[i].memory);
+        if (*failed || !chunks[i].ok) {
+            if (!*failed) {
+                *offset = chunks[i].start;
+                *failed = 1;
+            }
+            free_ast(chunks[i].first);
+            continue;
+        }
+
+        *offset = chunks[i].end;
+        if (chunks[i].first == NULL) {
+            continue;
+        }
+        if (first == NULL) {
+            first = chunks[i].first;
+        } else {
+            last->next = chunks[i].first;
+        }
+        for (last = chunks[i].first; last->next != NULL; last = last->next) {
+        }
+    }
+    free(chunks);
+    return first;
+}
+
+// The parallel front end needs the whole window in memory, which the serial
+// one never does, so it is not used under a memory budget
+int use_parallel_front_end(int len) {
+    return pool_threads > 1 && len >= PARALLEL_PARSE_MIN && memory_limit == LLONG_MAX;
+}
+
+int show_stats = 0;
+
+// Whether a statement has a loop anywhere in it
+int contains_loop(ASTNode* node) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_LOOP || node->type == NODE_PLOOP) {
+            return 1;
+        }
+        if (contains_loop(node->left) || contains_loop(node->right) ||
+            contains_loop(node->condition)) {
+            return 1;
+        }
+        if (node->cond_chain != NULL &&
+            (contains_loop(node->cond_chain->condition) || contains_loop(node->cond_chain->body))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Inference and memoization only pay off in loops; straight-line statements
+// run once and go through the generic paths
+void prepare_statement(ASTNode* node) {
+    if (contains_loop(node)) {
+        infer_program(node);
+        memoize_blocks(node, 0);
+    }
+}
+
+void run_statement(ASTNode* node) {
+    prepare_statement(node);
+    interpret_node(node);
+    free_ast(node);
+}
+
+// Snapshot images
+// `snapshot;` marks the point where `pavo --snapshot out.img` stops: the
+// variables and the rest of the program, already parsed, are written to a
+// flat image that `pavo --resume out.img` maps and continues from. Nodes
+// refer to each other by index and to their text by offset into a string
+// pool. Resuming maps the image, checks it and copies the nodes back into
+// ordinary heap nodes in one pass over the arrays, so nothing is lexed or
+// parsed again; the mapping is dropped once the copy is made.
+#define IMAGE_MAGIC "PAVOIMG"
+#define IMAGE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t symbol_count;
+    uint32_t node_count;
+    uint32_t loop_count;
+    uint32_t string_size;
+    int32_t first;              // first statement after the snapshot point
+} ImageHeader;
+
+typedef struct {
+    uint32_t name;
+    int32_t type;
+    int32_t value;
+} ImageSymbol;
+
+// Children are node indexes, -1 when absent; text is a string pool offset
+typedef struct {
+    int32_t type;
+    uint32_t value;
+    int32_t left, right, next, condition;
+    int32_t branch_condition, branch_body;
+    int32_t ploop;
+    int32_t fold;
+} ImageNode;
+
+typedef struct {
+    int32_t start, end;
+    int32_t reduction_count;
+    int32_t ops[MAX_REDUCTIONS];
+    uint32_t reductions[MAX_REDUCTIONS];
+} ImageLoop;
+
+const char* snapshot_path = NULL;
+
+typedef struct {
+    ImageNode* nodes;
+    int node_count, node_capacity;
+    ImageLoop* loops;
+    int loop_count, loop_capacity;
+    char* strings;
+    int string_size, string_capacity;
+} ImageWriter;
+
+void* image_grow(void* items, int* capacity, int needed, size_t size) {
+    if (needed > *capacity) {
+        while (needed > *capacity) {
+            *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        }
+        items = realloc(items, *capacity * size);
+    }
+    return items;
+}
+
+uint32_t image_string(ImageWriter* writer, const char* text) {
+    if (text[0] == '\0') {
+        return 0;   // the pool starts with the empty string
+    }
+    int len = strlen(text) + 1;
+    writer->strings = image_grow(writer->strings, &writer->string_capacity, writer->string_size + len, 1);
+    memcpy(writer->strings + writer->string_size, text, len);
+    writer->string_size += len;
+    return writer->string_size - len;
+}
+
+int32_t image_chain(ImageWriter* writer, ASTNode* node);
+
+int32_t image_loop(ImageWriter* writer, ParallelLoop* loop) {
+    writer->loops = image_grow(writer->loops, &writer->loop_capacity, writer->loop_count + 1, sizeof(ImageLoop));
+    int32_t index = writer->loop_count++;
+
+    ImageLoop packed;
+    memset(&packed, 0, sizeof(packed));
+    packed.start = image_chain(writer, loop->start);
+    packed.end = image_chain(writer, loop->end);
+    packed.reduction_count = loop->reduction_count;
+    for (int i = 0; i < loop->reduction_count; i++) {
+        packed.ops[i] = loop->ops[i];
+        packed.reductions[i] = image_string(writer, loop->reductions[i]);
+    }
+    writer->loops[index] = packed;
+    return index;
+}
+
+// Pack a statement or expression chain; returns the index of its first node
+int32_t image_chain(ImageWriter* writer, ASTNode* node) {
+    int32_t first = -1;
+    int32_t previous = -1;
+    for (; node != NULL; node = node->next) {
+        writer->nodes = image_grow(writer->nodes, &writer->node_capacity, writer->node_count + 1, sizeof(ImageNode));
+        int32_t index = writer->node_count++;
+        if (previous >= 0) {
+            writer->nodes[previous].next = index;
+        } else {
+            first = index;
+        }
+
+        // packing the children may move the node array, so fill it in last
+        ImageNode packed;
+        packed.type = node->type;
+        packed.value = image_string(writer, node->value);
+        packed.left = image_chain(writer, node->left);
+        packed.right = image_chain(writer, node->right);
+        packed.next = -1;
+        packed.condition = image_chain(writer, node->condition);
+        packed.branch_condition = -1;
+        packed.branch_body = -1;
+        if (node->cond_chain != NULL) {
+            packed.branch_condition = image_chain(writer, node->cond_chain->condition);
+            packed.branch_body = image_chain(writer, node->cond_chain->body);
+        }
+        packed.ploop = node->ploop != NULL ? image_loop(writer, node->ploop) : -1;
+        packed.fold = node->fold;
+        writer->nodes[index] = packed;
+        previous = index;
+    }
+    return first;
+}
+
+// Write the variables and the rest of the program, then stop
+void write_image(const char* path, ASTNode* rest) {
+    ImageWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.strings = image_grow(NULL, &writer.string_capacity, 1, 1);
+    writer.strings[0] = '\0';
+    writer.string_size = 1;
+
+    ImageSymbol* symbols = malloc((symbol_count > 0 ? symbol_count : 1) * sizeof(ImageSymbol));
+    for (int i = 0; i < symbol_count; i++) {
+        symbols[i].name = image_string(&writer, symbol_table[i].name);
+        symbols[i].type = symbol_table[i].type;
+        symbols[i].value = symbol_table[i].value;
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.symbol_count = symbol_count;
+    header.first = image_chain(&writer, rest);
+    header.node_count = writer.node_count;
+    header.loop_count = writer.loop_count;
+    header.string_size = writer.string_size;
+
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "error: could not open '%s'\n", path);
+        exit(1);
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(symbols, sizeof(ImageSymbol), symbol_count, out);
+    fwrite(writer.nodes, sizeof(ImageNode), writer.node_count, out);
+    fwrite(writer.loops, sizeof(ImageLoop), writer.loop_count, out);
+    fwrite(writer.strings, 1, writer.string_size, out);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "error: could not write '%s'\n", path);
+        exit(1);
+    }
+
+    fprintf(stderr, "snapshot: %d variables, %d nodes, %ld bytes written to %s\n",
+            symbol_count, writer.node_count, (long)(sizeof(header) + symbol_count * sizeof(ImageSymbol) +
+            writer.node_count * sizeof(ImageNode) + writer.loop_count * sizeof(ImageLoop) + writer.string_size),
+            path);
+    free(symbols);
+    free(writer.nodes);
+    free(writer.loops);
+    free(writer.strings);
+    free_ast(rest);
+    exit(0);
+}
+
+typedef struct {
+    const char* path;
+    const ImageNode* nodes;
+    uint32_t node_count;
+    const ImageLoop* loops;
+    uint32_t loop_count;
+    const char* strings;
+    uint32_t string_size;
+    char* used;                 // each node and loop is unpacked once
+} ImageReader;
+
+void image_corrupt(ImageReader* reader) {
+    fprintf(stderr, "error: '%s' is not a valid pavo image\n", reader->path);
+    exit(1);
+}
+
+const char* image_text(ImageReader* reader, uint32_t offset) {
+    if (offset >= reader->string_size ||
+        memchr(reader->strings + offset, '\0', reader->string_size - offset) == NULL ||
+        strlen(reader->strings + offset) >= MAX_TOKEN_LEN) {
+        image_corrupt(reader);
+    }
+    return reader->strings + offset;
+}
+
+ASTNode* image_unpack(ImageReader* reader, int32_t index);
+
+ParallelLoop* image_unpack_loop(ImageReader* reader, int32_t index) {
+    if (index < 0 || (uint32_t)index >= reader->loop_count || reader->used[reader->node_count + index]) {
+        image_corrupt(reader);
+    }
+    reader->used[reader->node_count + index] = 1;
+    const ImageLoop* packed = &reader->loops[index];
+    if (packed->reduction_count < 0 || packed->reduction_count > MAX_REDUCTIONS) {
+        image_corrupt(reader);
+    }
+
+    budget_charge(sizeof(ParallelLoop));
+    ParallelLoop* loop = malloc(sizeof(ParallelLoop));
+    loop->start = image_unpack(reader, packed->start);
+    loop->end = image_unpack(reader, packed->end);
+    loop->reduction_count = packed->reduction_count;
+    for (int i = 0; i < loop->reduction_count; i++) {
+        if (packed->ops[i] < REDUCE_ADD || packed->ops[i] > REDUCE_MIN) {
+            image_corrupt(reader);
+        }
+        loop->ops[i] = packed->ops[i];
+        strcpy(loop->reductions[i], image_text(reader, packed->reductions[i]));
+    }
+    if (loop->start == NULL || loop->end == NULL) {
+        image_corrupt(reader);
+    }
+    return loop;
+}
+
+// Whether a node has the children the interpreter relies on
+int image_shape_ok(ASTNode* node) {
+    switch (node->type) {
+        case NODE_ASSIGN:
+        case NODE_REASSIGN:
+            return node->left != NULL && node->left->type == NODE_VARIABLE && node->right != NULL;
+        case NODE_BINOP:
+        case NODE_COMPARE:
+            return node->left != NULL && node->right != NULL;
+        case NODE_LOGIC:
+            return node->right != NULL && (node->left != NULL || strcmp(node->value, "!") == 0);
+        case NODE_PRINT:
+        case NODE_RETURN:
+            return node->right != NULL;
+        case NODE_IF_STMT:
+            return node->cond_chain != NULL && node->cond_chain->condition != NULL;
+        case NODE_PLOOP:
+            return node->ploop != NULL && node->left != NULL && node->left->type == NODE_VARIABLE;
+        default:
+            return 1;
+    }
+}
+
+ASTNode* image_unpack(ImageReader* reader, int32_t index) {
+    ASTNode* first = NULL;
+    ASTNode* current = NULL;
+    while (index != -1) {
+        if (index < 0 || (uint32_t)index >= reader->node_count || reader->used[index]) {
+            image_corrupt(reader);
+        }
+        reader->used[index] = 1;
+        const ImageNode* packed = &reader->nodes[index];
+        if (packed->type < NODE_NUMBER || packed->type > NODE_SNAPSHOT ||
+            (packed->fold != REDUCE_NONE && packed->type != NODE_REASSIGN) ||
+            (packed->fold != REDUCE_NONE && packed->fold != REDUCE_MAX && packed->fold != REDUCE_MIN)) {
+            image_corrupt(reader);
+        }
+
+        ASTNode* node = create_text_node(packed->type, image_text(reader, packed->value));
+        node->fold = packed->fold;
+        node->left = image_unpack(reader, packed->left);
+        node->right = image_unpack(reader, packed->right);
+        node->condition = image_unpack(reader, packed->condition);
+        if (packed->branch_condition != -1 || packed->branch_body != -1) {
+            budget_charge(sizeof(ConditionalBranch));
+            node->cond_chain = malloc(sizeof(ConditionalBranch));
+            node->cond_chain->condition = image_unpack(reader, packed->branch_condition);
+            node->cond_chain->body = image_unpack(reader, packed->branch_body);
+        }
+        if (packed->ploop != -1) {
+            node->ploop = image_unpack_loop(reader, packed->ploop);
+        }
+        if (!image_shape_ok(node)) {
+            image_corrupt(reader);
+        }
+
+        if (first == NULL) {
+            first = node;
+        } else {
+            current->next = node;
+        }
+        current = node;
+        index = packed->next;
+    }
+    return first;
+}
+
+// Map an image, restore its variables and return the rest of its program
+ASTNode* load_image(const char* path) {
+    ImageReader reader;
+    reader.path = path;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: could not open '%s'\n", path);
+        exit(1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ImageHeader)) {
+        image_corrupt(&reader);
+    }
+    const char* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "error: could not map '%s'\n", path);
+        exit(1);
+    }
+
+    const ImageHeader* header = (const ImageHeader*)base;
+    uint64_t size = sizeof(ImageHeader) + (uint64_t)header->symbol_count * sizeof(ImageSymbol) +
+                    (uint64_t)header->node_count * sizeof(ImageNode) +
+                    (uint64_t)header->loop_count * sizeof(ImageLoop) + header->string_size;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 || header->version != IMAGE_VERSION ||
+        size != (uint64_t)st.st_size || header->symbol_count > MAX_IDENTIFIERS || header->string_size == 0 ||
+        base[st.st_size - 1] != '\0') {
+        image_corrupt(&reader);
+    }
+
+    const ImageSymbol* symbols = (const ImageSymbol*)(header + 1);
+    reader.nodes = (const ImageNode*)(symbols + header->symbol_count);
+    reader.node_count = header->node_count;
+    reader.loops = (const ImageLoop*)(reader.nodes + header->node_count);
+    reader.loop_count = header->loop_count;
+    reader.strings = (const char*)(reader.loops + header->loop_count);
+    reader.string_size = header->string_size;
+    reader.used = calloc((size_t)header->node_count + header->loop_count + 1, 1);
+
+    symbol_count = header->symbol_count;
+    for (int i = 0; i < symbol_count; i++) {
+        strcpy(symbol_table[i].name, image_text(&reader, symbols[i].name));
+        symbol_table[i].type = symbols[i].type;
+        symbol_table[i].value = symbols[i].value;
+    }
+    ASTNode* program = image_unpack(&reader, header->first);
+
+    free(reader.used);
+    munmap((void*)base, st.st_size);
+    return program;
+}
+
+// Append the statements left in the source to a list
+ASTNode* parse_rest(ASTNode* list) {
+    ASTNode* last = list;
+    while (last != NULL && last->next != NULL) {
+        last = last->next;
+    }
+    while (current_token.type != TOKEN_EOF) {
+        ASTNode* stmt = parse_statement();
+        if (last == NULL) {
+            list = stmt;
+        } else {
+            last->next = stmt;
+        }
+        last = stmt;
+    }
+    return list;
+}
+
+// Execution time is wall time: clock() would add up the CPU time of every
+// ploop worker and hide any speedup
+void report_run(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("execution time: %f seconds\n",
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    if (show_stats) {
+        fprintf(stderr, "memo: %d pure blocks, %ld hits, %ld misses\n",
+                memo_blocks, memo_hits, memo_misses);
+    }
+}
+
+// Main interpreter function
+void interpret(const char* input) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Initialize interpreter
+    int len = strlen(input);
+    int offset = 0;
+    symbol_count = 0;
+
+    // Parse large sources window by window on the thread pool
+    if (use_parallel_front_end(len)) {
+        int failed = 0;
+        while (offset < len && !failed) {
+            ASTNode* stmt = parse_window(input, len, &offset, &failed);
+            while (stmt != NULL) {
+                ASTNode* next = stmt->next;
+                stmt->next = NULL;
+                if (stmt->type == NODE_SNAPSHOT && snapshot_path != NULL) {
+                    free_ast(stmt);
+                    source = (char*)input;
+                    source_len = len;
+                    pos = offset;
+                    current_token = get_next_token();
+                    write_image(snapshot_path, parse_rest(next));
+                }
+                run_statement(stmt);
+                stmt = next;
+            }
+        }
+    }
+
+    // Serial front end, from wherever the parallel one stopped
+    source = (char*)input;
+    source_len = len;
+    pos = offset;
+
+    // Get first token
+    current_token = get_next_token();
+
+    // Parse and interpret until EOF
+    while (current_token.type != TOKEN_EOF) {
+        ASTNode* node = parse_statement();
+        if (node->type == NODE_SNAPSHOT && snapshot_path != NULL) {
+            free_ast(node);
+            write_image(snapshot_path, parse_rest(NULL));
+        }
+        run_statement(node);
+    }
+
+    if (snapshot_path != NULL) {
+        fprintf(stderr, "error: the program has no snapshot statement\n");
+        exit(1);
+    }
+    report_run(start);
+}
+
+// Continue a program from a snapshot image
+void resume_image(const char* path) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ASTNode* stmt = load_image(path);
+    while (stmt != NULL) {
+        ASTNode* next = stmt->next;
+        stmt->next = NULL;
+        if (stmt->type == NODE_SNAPSHOT && snapshot_path != NULL) {
+            free_ast(stmt);
+            write_image(snapshot_path, next);
+        }
+        run_statement(stmt);
+        stmt = next;
+    }
+
+    if (snapshot_path != NULL) {
+        fprintf(stderr, "error: the program has no snapshot statement\n");
+        exit(1);
+    }
+    report_run(start);
+}
+
+char* read_pavo_file(const char* filename){
+    const char* extension = strrchr(filename, '.');
+    if (extension==NULL || strcmp(extension, "pavo")==0){
+        fprintf(stderr, "error: the file extension .pavo\n");
+        return NULL;
+    }
+
+    FILE* file = fopen(filename, "r");
+    if (file==NULL){
+        fprintf(stderr, "error: could not open '%s'\n", filename);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* buffer = (char *)malloc(file_size + 1);
+    if (buffer==NULL){
+        fprintf(stderr, "error: could not allocate memory for the file\n");
+        fclose(file);
+        return NULL;
+    }
+
+    size_t bytes_read = fread(buffer, 1, file_size, file);
     buffer[bytes_read] = '\0';
 
     if (bytes_read<file_size) {
@@ -867,14 +3180,929 @@ void interpret_file(const char* filename){
     free(source);
 }
 
+// Parse a whole source file into a list of top-level statements
+ASTNode* parse_program(const char* input) {
+    source = (char*)input;
+    source_len = strlen(input);
+    pos = 0;
+
+    current_token = get_next_token();
+
+    ASTNode* first_stmt = NULL;
+    ASTNode* current = NULL;
+    while (current_token.type != TOKEN_EOF) {
+        ASTNode* stmt = parse_statement();
+        if (first_stmt == NULL) {
+            first_stmt = stmt;
+        } else {
+            current->next = stmt;
+        }
+        current = stmt;
+    }
+    return first_stmt;
+}
+
+// Watch mode
+// The program is kept parsed as one entry per top-level statement, with the
+// span of source it was parsed from. When the file changes, the statements
+// that lie entirely in the unchanged prefix or suffix of the text are reused
+// and only the ones in between are parsed again. Every run happens in a
+// forked child, so runtime errors, which exit, leave the parsed program alive.
+#ifndef WATCH_INTERVAL_MS
+#define WATCH_INTERVAL_MS 100
+#endif
+
+#define WATCH_LIST_MAX 8        // recompiled statements listed in a report
+
+typedef struct {
+    ASTNode* node;
+    int start, end;             // from the end of the previous statement to the end of its last token
+} WatchStatement;
+
+typedef struct {
+    char* source;
+    int len;
+    WatchStatement* statements;
+    int count, capacity;
+    int first_recompiled;       // the statements parsed by the last update
+    int recompiled;
+    int failed_at;              // start of the statement with a syntax error, or -1
+} WatchProgram;
+
+void watch_append(WatchProgram* program, ASTNode* node, int start, int end) {
+    if (program->count == program->capacity) {
+        program->capacity = program->capacity == 0 ? 64 : program->capacity * 2;
+        program->statements = realloc(program->statements, program->capacity * sizeof(WatchStatement));
+    }
+    program->statements[program->count].node = node;
+    program->statements[program->count].start = start;
+    program->statements[program->count].end = end;
+    program->count++;
+}
+
+// Parse the changed statements from the end of the reused prefix until one
+// starts where an old statement of the suffix now starts. Returns the index
+// of that old statement, or old->count, which reuses nothing more.
+int watch_parse_span(WatchProgram* old, WatchProgram* program, int first, int tail, int delta) {
+    int offset = first > 0 ? old->statements[first - 1].end : 0;
+    source = program->source;
+    source_len = program->len;
+    pos = offset;
+    lex_token(&current_token);
+    while (current_token.type != TOKEN_EOF) {
+        while (tail < old->count && old->statements[tail].start + delta < offset) {
+            tail++;
+        }
+        if (tail < old->count && old->statements[tail].start + delta == offset) {
+            return tail;
+        }
+
+        program->failed_at = offset;
+        parse_pending_count = 0;
+        ASTNode* node = parse_statement();
+        watch_append(program, node, offset, current_token.offset);
+        offset = current_token.offset;
+        program->recompiled++;
+    }
+    return old->count;
+}
+
+// Run watch_parse_span under a recovery point, so that a syntax error frees
+// the statement it stopped in and returns -1, with failed_at set. The frame
+// holds nothing that changes after setjmp.
+int watch_parse(WatchProgram* old, WatchProgram* program, int first, int tail, int delta) {
+    jmp_buf recovery;
+    if (setjmp(recovery) != 0) {
+        parse_recovery = NULL;
+        free_pending();
+        return -1;
+    }
+    parse_recovery = &recovery;
+    int reused_from = watch_parse_span(old, program, first, tail, delta);
+    parse_recovery = NULL;
+    parse_pending_count = 0;
+    program->failed_at = -1;
+    return reused_from;
+}
+
+// Build the program for a new source text from the previous one. Returns 0
+// and leaves the previous program untouched on a syntax error.
+int watch_update(WatchProgram* old, char* text, WatchProgram* program) {
+    int len = strlen(text);
+    int limit = len < old->len ? len : old->len;
+    int prefix = 0;
+    while (prefix < limit && text[prefix] == old->source[prefix]) {
+        prefix++;
+    }
+    int suffix = 0;
+    while (suffix < limit && text[len - 1 - suffix] == old->source[old->len - 1 - suffix]) {
+        suffix++;
+    }
+    int delta = len - old->len;
+
+    memset(program, 0, sizeof(*program));
+    program->source = text;
+    program->len = len;
+    program->failed_at = -1;
+
+    // statements are context free and end with ; or }, so one whose text is
+    // unchanged parses the same wherever it now starts
+    int first = 0;
+    while (first < old->count && old->statements[first].end <= prefix) {
+        watch_append(program, old->statements[first].node, old->statements[first].start, old->statements[first].end);
+        first++;
+    }
+    // the prefix and suffix may overlap; starting after the reused prefix
+    // statements keeps a statement from being taken twice
+    int tail = first;
+    while (tail < old->count && old->statements[tail].start < old->len - suffix) {
+        tail++;
+    }
+
+    program->first_recompiled = first;
+    int reused_from = watch_parse(old, program, first, tail, delta);
+    if (reused_from < 0) {
+        for (int i = first; i < program->count; i++) {
+            free_ast(program->statements[i].node);
+        }
+        free(program->statements);
+        return 0;
+    }
+
+    for (int i = reused_from; i < old->count; i++) {
+        watch_append(program, old->statements[i].node, old->statements[i].start + delta, old->statements[i].end + delta);
+    }
+    for (int i = first; i < reused_from; i++) {
+        free_ast(old->statements[i].node);
+    }
+    return 1;
+}
+
+// Print the syntax error of a failed update without taking the watcher down
+void watch_report_error(WatchProgram* program) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        source = program->source;
+        source_len = program->len;
+        pos = program->failed_at;
+        lex_token(&current_token);
+        while (current_token.type != TOKEN_EOF) {
+            parse_statement();
+        }
+        exit(0);
+    }
+    if (child > 0) {
+        waitpid(child, NULL, 0);
+    }
+}
+
+void watch_report(WatchProgram* program, double milliseconds) {
+    fprintf(stderr, "recompiled %d of %d statements in %.3f ms", program->recompiled, program->count, milliseconds);
+    source = program->source;
+    source_len = program->len;
+    for (int i = 0; i < program->recompiled && i < WATCH_LIST_MAX; i++) {
+        int line, column;
+        WatchStatement* stmt = &program->statements[program->first_recompiled + i];
+        source_position(prescan_skip(program->source, program->len, stmt->start), &line, &column);
+        fprintf(stderr, "%s%d", i == 0 ? ": lines " : ", ", line);
+    }
+    if (program->recompiled > WATCH_LIST_MAX) {
+        fprintf(stderr, ", ...");
+    }
+    fputc('\n', stderr);
+}
+
+// Whether the file was saved since seen was taken; now gets its new state
+int watch_changed(const char* filename, const struct stat* seen, struct stat* now) {
+    return stat(filename, now) == 0 && (now->st_size != seen->st_size ||
+        now->st_mtim.tv_sec != seen->st_mtim.tv_sec || now->st_mtim.tv_nsec != seen->st_mtim.tv_nsec);
+}
+
+void watch_sleep(int ms) {
+    struct timespec delay = {ms / 1000, (long)(ms % 1000) * 1000000};
+    nanosleep(&delay, NULL);
+}
+
+// Run the whole program in a child process. A save while it runs (say, to
+// fix an endless loop) stops the run, so that the new version is picked up.
+void watch_run(WatchProgram* program, const char* filename, const struct stat* seen) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+        fprintf(stderr, "error: could not start a run\n");
+        return;
+    }
+    if (child == 0) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        symbol_count = 0;
+        for (int i = 0; i < program->count; i++) {
+            ASTNode* node = program->statements[i].node;
+            prepare_statement(node);
+            interpret_node(node);
+        }
+        report_run(start);
+        exit(0);
+    }
+
+    int delay_ms = 1;
+    while (waitpid(child, NULL, WNOHANG) == 0) {
+        struct stat now;
+        if (watch_changed(filename, seen, &now)) {
+            kill(child, SIGKILL);
+            waitpid(child, NULL, 0);
+            fprintf(stderr, "run stopped: %s changed\n", filename);
+            return;
+        }
+        watch_sleep(delay_ms);
+        delay_ms = delay_ms * 2 < WATCH_INTERVAL_MS ? delay_ms * 2 : WATCH_INTERVAL_MS;
+    }
+}
+
+// Recompile and rerun a file whenever it changes, until interrupted
+int watch_file(const char* filename) {
+    WatchProgram program;
+    memset(&program, 0, sizeof(program));
+    program.source = calloc(1, 1);
+    program.failed_at = -1;
+
+    struct stat seen;
+    memset(&seen, 0, sizeof(seen));
+    while (1) {
+        struct stat st;
+        if (!watch_changed(filename, &seen, &st)) {
+            watch_sleep(WATCH_INTERVAL_MS);
+            continue;
+        }
+        seen = st;
+
+        char* text = read_pavo_file(filename);
+        if (text == NULL) {
+            continue;
+        }
+        if (program.count > 0 && strcmp(text, program.source) == 0) {
+            free(text);
+            continue;
+        }
+
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        WatchProgram next;
+        int ok = watch_update(&program, text, &next);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (!ok) {
+            watch_report_error(&next);
+            free(text);
+        } else {
+            free(program.source);
+            free(program.statements);
+            program = next;
+            watch_report(&program, (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6);
+            watch_run(&program, filename, &seen);
+        }
+        fprintf(stderr, "watching %s for changes\n", filename);
+    }
+}
+
+// C code generator (ahead-of-time compilation)
+// Every pavo variable becomes a C local v_<name> with a declared flag d_<name>,
+// so the generated program reports the same runtime errors as the interpreter.
+FILE* emit_out;
+int emit_indent = 0;
+int emit_temp_count = 0;
+NameTable emit_names;
+
+void emit_line(const char* format, ...) {
+    va_list args;
+    fprintf(emit_out, "%*s", emit_indent * 4, "");
+    va_start(args, format);
+    vfprintf(emit_out, format, args);
+    va_end(args);
+    fputc('\n', emit_out);
+}
+
+// known[i] is set once variable i is definitely declared at this point of the
+// program, which lets the generator drop the runtime declared-flag checks
+char* copy_known(const char* known) {
+    char* copy = malloc(emit_names.count > 0 ? emit_names.count : 1);
+    memcpy(copy, known, emit_names.count);
+    return copy;
+}
+
+int emit_node(ASTNode* node, char* known);
+
+// Emit a statement list; inside a loop body the interpreter leaves the loop
+// on break or on any statement that yields the -999999 sentinel
+void emit_chain(ASTNode* stmt, char* known, int in_loop) {
+    for (; stmt != NULL; stmt = stmt->next) {
+        if (in_loop && stmt->type == NODE_BREAK) {
+            emit_line("break;");
+            return;
+        }
+
+        int t = emit_node(stmt, known);
+        if (in_loop && stmt->type != NODE_IF_STMT && stmt->type != NODE_LOOP &&
+            stmt->lo <= -999999 && stmt->hi >= -999999) {
+            emit_line("if (t%d == -999999) break;", t);
+        }
+    }
+}
+
+// Emit C statements computing the value of a node; returns its temporary
+int emit_node(ASTNode* node, char* known) {
+    int t;
+
+    switch (node->type) {
+        case NODE_NUMBER:
+            t = emit_temp_count++;
+            emit_line("int t%d = %d;", t, atoi(node->value));
+            return t;
+
+        case NODE_VARIABLE: {
+            int var = name_index(&emit_names, node->value);
+            if (!known[var]) {
+                emit_line("if (!d_%s) pavo_undefined(\"%s\");", node->value, node->value);
+                known[var] = 1;
+            }
+            t = emit_temp_count++;
+            emit_line("int t%d = v_%s;", t, node->value);
+            return t;
+        }
+
+        case NODE_ASSIGN: {
+            const char* name = node->left->value;
+            int var = name_index(&emit_names, name);
+            if (known[var]) {
+                emit_line("pavo_redeclared(\"%s\");", name);
+            } else {
+                emit_line("if (d_%s) pavo_redeclared(\"%s\");", name, name);
+            }
+
+            t = emit_node(node->right, known);
+            if (emit_names.count > MAX_IDENTIFIERS) {
+                emit_line("if (!d_%s) { if (pavo_count >= %d) pavo_too_many(); pavo_count++; }",
+                          name, MAX_IDENTIFIERS);
+            }
+            emit_line("d_%s = 1;", name);
+            emit_line("v_%s = t%d;", name, t);
+            known[var] = 1;
+            return t;
+        }
+
+        case NODE_REASSIGN: {
+            const char* name = node->left->value;
+            int var = name_index(&emit_names, name);
+            if (!known[var]) {
+                emit_line("if (!d_%s) pavo_undeclared();", name);
+                known[var] = 1;
+            }
+
+            t = emit_node(node->right, known);
+            if (node->fold == REDUCE_MAX) {
+                emit_line("if (t%d > v_%s) v_%s = t%d;", t, name, name, t);
+            } else if (node->fold == REDUCE_MIN) {
+                emit_line("if (t%d < v_%s) v_%s = t%d;", t, name, name, t);
+            } else {
+                emit_line("v_%s = t%d;", name, t);
+            }
+            return t;
+        }
+
+        case NODE_PRINT:
+            t = emit_node(node->right, known);
+            emit_line("printf(\"%%d\\n\", t%d);", t);
+            return t;
+
+        case NODE_LOGIC: {
+            if (strcmp(node->value, "!") == 0) {
+                int r = emit_node(node->right, known);
+                t = emit_temp_count++;
+                if (node->right->vtype == TYPE_BOOL) {
+                    emit_line("int t%d = t%d ^ 1;", t, r);
+                } else {
+                    emit_line("int t%d = t%d == 0;", t, r);
+                }
+                return t;
+            }
+
+            int l = emit_node(node->left, known);
+            int r = emit_node(node->right, known);
+            t = emit_temp_count++;
+            if (node->left->vtype == TYPE_BOOL && node->right->vtype == TYPE_BOOL) {
+                emit_line("int t%d = t%d %s t%d;", t, l, node->value, r);
+                return t;
+            }
+            emit_line("int t%d = t%d != 0 %s t%d != 0;", t, l,
+                      strcmp(node->value, "&") == 0 ? "&&" : "||", r);
+            return t;
+        }
+
+        case NODE_BINOP: {
+            int l = emit_node(node->left, known);
+            int r = emit_node(node->right, known);
+            t = emit_temp_count++;
+            if (node->value[0] == '/' || node->value[0] == '%') {
+                if (divisor_safe(node)) {
+                    emit_line("int t%d = t%d %s t%d;", t, l, node->value, r);
+                } else {
+                    emit_line("int t%d = pavo_divide(t%d, t%d, %d);", t, l, r, node->value[0] == '%');
+                }
+                return t;
+            }
+            if (binop_fits(node)) {
+                emit_line("int t%d = t%d %s t%d;", t, l, node->value, r);
+                return t;
+            }
+            // wrap on overflow like the interpreter does in practice
+            emit_line("int t%d = (int)((unsigned)t%d %s (unsigned)t%d);", t, l, node->value, r);
+            return t;
+        }
+
+        case NODE_COMPARE: {
+            int l = emit_node(node->left, known);
+            int r = emit_node(node->right, known);
+            t = emit_temp_count++;
+            emit_line("int t%d = t%d %s t%d;", t, l, node->value, r);
+            return t;
+        }
+
+        case NODE_IF_STMT: {
+            ConditionalBranch* branch = node->cond_chain;
+            int c = emit_node(branch->condition, known);
+
+            emit_line("if (t%d != 0) {", c);
+            emit_indent++;
+            char* body_known = copy_known(known);
+            emit_chain(branch->body, body_known, 0);
+            free(body_known);
+            emit_indent--;
+            emit_line("}");
+
+            t = emit_temp_count++;
+            emit_line("int t%d = 0;", t);
+            return t;
+        }
+
+        case NODE_BLOCK: {
+            // a value block always ends with its return statement
+            t = emit_temp_count++;
+            emit_line("int t%d = 0;", t);
+            for (ASTNode* stmt = node->right; stmt != NULL; stmt = stmt->next) {
+                int value = emit_node(stmt, known);
+                emit_line("t%d = t%d;", t, value);
+            }
+            return t;
+        }
+
+        case NODE_RETURN:
+            return emit_node(node->right, known);
+
+        case NODE_LOOP: {
+            emit_line("while (1) {");
+            emit_indent++;
+            if (node->condition != NULL) {
+                int c = emit_node(node->condition, known);
+                emit_line("if (t%d == 0) break;", c);
+            }
+            char* body_known = copy_known(known);
+            emit_chain(node->right, body_known, 1);
+            free(body_known);
+            emit_indent--;
+            emit_line("}");
+
+            t = emit_temp_count++;
+            emit_line("int t%d = 0;", t);
+            return t;
+        }
+
+        case NODE_BREAK:
+            t = emit_temp_count++;
+            emit_line("int t%d = -999999;", t);
+            return t;
+
+        case NODE_SNAPSHOT:
+            t = emit_temp_count++;
+            emit_line("int t%d = 0;", t);
+            return t;
+
+        case NODE_PLOOP: {
+            // run serially with the interpreter's private reduction copies
+            ParallelLoop* loop = node->ploop;
+            int start = emit_node(loop->start, known);
+            int end = emit_node(loop->end, known);
+            int partials = emit_temp_count;
+            emit_temp_count += loop->reduction_count;
+            for (int i = 0; i < loop->reduction_count; i++) {
+                int var = name_index(&emit_names, loop->reductions[i]);
+                if (!known[var]) {
+                    emit_line("if (!d_%s) pavo_undefined(\"%s\");", loop->reductions[i], loop->reductions[i]);
+                    known[var] = 1;
+                }
+            }
+
+            // private variables start every iteration as they were outside
+            NameTable private = {0};
+            collect_declared(&private, node->right);
+            int outer = emit_temp_count;
+            emit_temp_count += 2 * private.count;
+            int index = emit_temp_count++;
+            emit_line("if (t%d < t%d) {", start, end);
+            emit_indent++;
+            for (int i = 0; i < private.count; i++) {
+                emit_line("if (d_%s) pavo_redeclared(\"%s\");", private.names[i], private.names[i]);
+            }
+            for (int i = 0; i < private.count; i++) {
+                emit_line("int t%d = v_%s, t%d = d_%s;", outer + 2 * i, private.names[i], outer + 2 * i + 1,
+                          private.names[i]);
+            }
+            for (int i = 0; i < loop->reduction_count; i++) {
+                emit_line("int t%d = %d;", partials + i, reduce_identity(loop->ops[i]));
+            }
+            emit_line("for (int t%d = t%d; t%d < t%d; t%d++) {", index, start, index, end, index);
+            emit_indent++;
+            char* body_known = copy_known(known);
+            emit_line("int v_%s = t%d, d_%s = 1;", node->left->value, index, node->left->value);
+            body_known[name_index(&emit_names, node->left->value)] = 1;
+            for (int i = 0; i < loop->reduction_count; i++) {
+                emit_line("int v_%s = t%d, d_%s = 1;", loop->reductions[i], partials + i, loop->reductions[i]);
+            }
+            for (int i = 0; i < private.count; i++) {
+                emit_line("int v_%s = t%d, d_%s = t%d;", private.names[i], outer + 2 * i, private.names[i],
+                          outer + 2 * i + 1);
+            }
+            free(private.names);
+            emit_chain(node->right, body_known, 0);
+            free(body_known);
+            for (int i = 0; i < loop->reduction_count; i++) {
+                emit_line("t%d = v_%s;", partials + i, loop->reductions[i]);
+            }
+            emit_indent--;
+            emit_line("}");
+
+            for (int i = 0; i < loop->reduction_count; i++) {
+                const char* r = loop->reductions[i];
+                int p = partials + i;
+                switch (loop->ops[i]) {
+                    case REDUCE_ADD:
+                        emit_line("v_%s = (int)((unsigned)v_%s + (unsigned)t%d);", r, r, p);
+                        break;
+                    case REDUCE_AND:
+                        emit_line("v_%s = v_%s != 0 && t%d != 0;", r, r, p);
+                        break;
+                    case REDUCE_OR:
+                        emit_line("v_%s = v_%s != 0 || t%d != 0;", r, r, p);
+                        break;
+                    case REDUCE_MAX:
+                        emit_line("v_%s = v_%s > t%d ? v_%s : t%d;", r, r, p, r, p);
+                        break;
+                    case REDUCE_MIN:
+                        emit_line("v_%s = v_%s < t%d ? v_%s : t%d;", r, r, p, r, p);
+                        break;
+                    case REDUCE_NONE:
+                        break;
+                }
+            }
+            emit_indent--;
+            emit_line("}");
+
+            t = emit_temp_count++;
+            emit_line("int t%d = 0;", t);
+            return t;
+        }
+    }
+
+    fprintf(stderr, "cannot compile node type %d\n", node->type);
+    exit(1);
+}
+
+// Translate a parsed program into a self-contained C translation unit
+void emit_program(ASTNode* program, FILE* out) {
+    emit_out = out;
+    emit_indent = 0;
+    emit_temp_count = 0;
+    emit_names.count = 0;
+    collect_names(&emit_names, program);
+
+    emit_line("#include <stdio.h>");
+    emit_line("#include <stdlib.h>");
+    emit_line("#include <time.h>");
+    emit_line("");
+    emit_line("static void pavo_undefined(const char* name) {");
+    emit_line("    fprintf(stderr, \"Undefined variable: %%s\\n\", name);");
+    emit_line("    exit(1);");
+    emit_line("}");
+    emit_line("static void pavo_redeclared(const char* name) {");
+    emit_line("    fprintf(stderr, \"var %%s is declared already\\n\", name);");
+    emit_line("    exit(1);");
+    emit_line("}");
+    emit_line("static void pavo_undeclared(void) {");
+    emit_line("    fprintf(stderr, \"cannot reassign undeclared variable\\n\");");
+    emit_line("    exit(1);");
+    emit_line("}");
+    emit_line("static void pavo_too_many(void) {");
+    emit_line("    fprintf(stderr, \"Too many variables\\n\");");
+    emit_line("    exit(1);");
+    emit_line("}");
+    emit_line("static int pavo_divide(int left, int right, int remainder) {");
+    emit_line("    if (right == 0) {");
+    emit_line("        fprintf(stderr, \"division by zero\\n\");");
+    emit_line("        exit(1);");
+    emit_line("    }");
+    emit_line("    if (right == -1) return remainder ? 0 : (int)(0u - (unsigned)left);");
+    emit_line("    return remainder ? left %% right : left / right;");
+    emit_line("}");
+    emit_line("");
+    emit_line("int main(void) {");
+    emit_indent++;
+    emit_line("clock_t pavo_start = clock();");
+    emit_line("int pavo_count = 0;");
+    for (int i = 0; i < emit_names.count; i++) {
+        emit_line("int v_%s = 0, d_%s = 0;", emit_names.names[i], emit_names.names[i]);
+    }
+
+    char* known = calloc(emit_names.count > 0 ? emit_names.count : 1, 1);
+    emit_chain(program, known, 0);
+    free(known);
+
+    emit_line("clock_t pavo_end = clock();");
+    emit_line("printf(\"execution time: %%f seconds\\n\", ((double)(pavo_end-pavo_start))/CLOCKS_PER_SEC);");
+    emit_line("(void)pavo_undefined; (void)pavo_redeclared; (void)pavo_undeclared;");
+    emit_line("(void)pavo_too_many; (void)pavo_divide; (void)pavo_count;");
+    emit_line("return 0;");
+    emit_indent--;
+    emit_line("}");
+}
+
+// Compile a pavo file to C (--emit-c) or all the way to an executable (build)
+int compile_file(const char* filename, const char* output, int build) {
+    char* input = read_pavo_file(filename);
+    if (input==NULL){
+        return 1;
+    }
+
+    ASTNode* program = parse_program(input);
+    infer_program(program);
+
+    char c_path[1040];
+    char exe_path[1024];
+    if (build) {
+        if (output != NULL) {
+            snprintf(exe_path, sizeof(exe_path), "%s", output);
+        } else {
+            // default to the source name without its extension
+            snprintf(exe_path, sizeof(exe_path), "%.*s",
+                     (int)(strrchr(filename, '.') - filename), filename);
+        }
+        snprintf(c_path, sizeof(c_path), "%s.c", exe_path);
+        output = c_path;
+    }
+
+    FILE* out = stdout;
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out==NULL){
+            fprintf(stderr, "error: could not open '%s'\n", output);
+            free_ast(program);
+            free(input);
+            return 1;
+        }
+    }
+
+    emit_program(program, out);
+    if (out != stdout) {
+        fclose(out);
+    }
+    free_ast(program);
+    free(input);
+
+    if (!build) {
+        return 0;
+    }
+
+    // $CC may carry its own flags ("gcc -m32"), so split it on blanks; the
+    // paths are passed as arguments as they are, never through a shell
+    const char* cc = getenv("CC");
+    char compiler[1024];
+    snprintf(compiler, sizeof(compiler), "%s", cc != NULL && cc[0] != '\0' ? cc : "cc");
+    char* args[64];
+    int count = 0;
+    for (char* word = strtok(compiler, " \t"); word != NULL && count < 59; word = strtok(NULL, " \t")) {
+        args[count++] = word;
+    }
+    args[count++] = "-O2";
+    args[count++] = "-o";
+    args[count++] = exe_path;
+    args[count++] = c_path;
+    args[count] = NULL;
+
+    int status = -1;
+    pid_t child = fork();
+    if (child == 0) {
+        execvp(args[0], args);
+        fprintf(stderr, "error: could not run '%s'\n", args[0]);
+        _exit(127);
+    }
+    if (child > 0) {
+        waitpid(child, &status, 0);
+    }
+    remove(c_path);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "error: C compiler failed: %s\n", args[0]);
+        return 1;
+    }
+    return 0;
+}
+
+// Lex a whole file without parsing it and report the throughput
+int bench_lex_file(const char* filename) {
+    char* input = read_pavo_file(filename);
+    if (input==NULL){
+        return 1;
+    }
+
+    clock_t start = clock();
+    source = input;
+    source_len = strlen(input);
+    pos = 0;
+    long tokens = 0;
+    while (get_next_token().type != TOKEN_EOF) {
+        tokens++;
+    }
+    double seconds = ((double)(clock()-start))/CLOCKS_PER_SEC;
+
+    printf("lexed %d bytes, %ld tokens in %f seconds (%.1f MB/s)\n",
+           source_len, tokens, seconds, source_len / (seconds > 0 ? seconds : 1e-9) / 1e6);
+
+    // the statement pre-scan of the parallel front end
+    start = clock();
+    int chunks = 0;
+    for (int p = 0; p < source_len; chunks++) {
+        p = chunk_end(input, source_len, p);
+    }
+    seconds = ((double)(clock()-start))/CLOCKS_PER_SEC;
+    printf("pre-scanned %d bytes, %d chunks in %f seconds (%.1f MB/s)\n",
+           source_len, chunks, seconds, source_len / (seconds > 0 ? seconds : 1e-9) / 1e6);
+    free(input);
+    return 0;
+}
+
+// Run only the front end over a whole file and report how long it took
+int bench_parse_file(const char* filename) {
+    char* input = read_pavo_file(filename);
+    if (input==NULL){
+        return 1;
+    }
+
+    clock_t start = clock();
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    int len = strlen(input);
+    int offset = 0;
+    long statements = 0;
+    if (use_parallel_front_end(len)) {
+        int failed = 0;
+        while (offset < len && !failed) {
+            ASTNode* stmt = parse_window(input, len, &offset, &failed);
+            for (ASTNode* s = stmt; s != NULL; s = s->next) {
+                statements++;
+            }
+            free_ast(stmt);
+        }
+    }
+
+    source = input;
+    source_len = len;
+    pos = offset;
+    current_token = get_next_token();
+    while (current_token.type != TOKEN_EOF) {
+        free_ast(parse_statement());
+        statements++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    printf("parsed %d bytes, %ld statements with %d threads in %f seconds (cpu %f)\n",
+           len, statements, use_parallel_front_end(len) ? pool_threads : 1, wall,
+           ((double)(clock()-start))/CLOCKS_PER_SEC);
+    free(input);
+    return 0;
+}
+
+void usage(const char* program) {
+    fprintf(stderr, "usage: %s [--stats] [--jobs N] [--fuel N] [--mem-limit BYTES] [--snapshot out.img] <filename.pavo>\n", program);
+    fprintf(stderr, "       %s [--stats] [--jobs N] [--fuel N] [--mem-limit BYTES] [--snapshot out.img] --resume <image>\n", program);
+    fprintf(stderr, "       %s [--stats] [--jobs N] [--fuel N] [--mem-limit BYTES] --watch <filename.pavo>\n", program);
+    fprintf(stderr, "       %s --emit-c <filename.pavo> [-o output.c]\n", program);
+    fprintf(stderr, "       %s build <filename.pavo> [-o executable]\n", program);
+    fprintf(stderr, "       %s --bench-lex <filename.pavo>\n", program);
+    fprintf(stderr, "       %s [--jobs N] --bench-parse <filename.pavo>\n", program);
+    fprintf(stderr, "example: %s program.pavo\n", program);
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 2){
-        fprintf(stderr, "usage: %s <filename.pavo>\n", argv[0]);
-        fprintf(stderr, "example: %s program.pavo\n", argv[0]);
+    const char* filename = NULL;
+    const char* output = NULL;
+    int compile = 0;
+    int build = 0;
+    int bench_lex = 0;
+    int bench_parse = 0;
+    const char* resume = NULL;
+    int watch = 0;
+
+    pool_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pool_threads < 1) {
+        pool_threads = 1;
+    } else if (pool_threads > MAX_POOL_THREADS) {
+        pool_threads = MAX_POOL_THREADS;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--emit-c")==0){
+            compile = 1;
+        } else if (i == 1 && strcmp(argv[i], "build")==0){
+            compile = 1;
+            build = 1;
+        } else if (strcmp(argv[i], "-o")==0 && i + 1 < argc){
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--stats")==0){
+            show_stats = 1;
+        } else if (strcmp(argv[i], "--bench-lex")==0){
+            bench_lex = 1;
+        } else if (strcmp(argv[i], "--bench-parse")==0){
+            bench_parse = 1;
+        } else if (strcmp(argv[i], "--watch")==0){
+            watch = 1;
+        } else if (strcmp(argv[i], "--snapshot")==0 && i + 1 < argc){
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--resume")==0 && i + 1 < argc){
+            resume = argv[++i];
+        } else if (strcmp(argv[i], "--jobs")==0 && i + 1 < argc){
+            pool_threads = atoi(argv[++i]);
+            if (pool_threads < 1 || pool_threads > MAX_POOL_THREADS){
+                fprintf(stderr, "error: --jobs expects an integer from 1 to %d\n", MAX_POOL_THREADS);
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "--fuel")==0 || strcmp(argv[i], "--mem-limit")==0) && i + 1 < argc){
+            char* end;
+            long long limit = strtoll(argv[i + 1], &end, 10);
+            if (*end != '\0' || limit < 0){
+                fprintf(stderr, "error: %s expects a non-negative integer\n", argv[i]);
+                return 1;
+            }
+#ifdef PAVO_NO_BUDGETS
+            fprintf(stderr, "error: %s is not available in a build with PAVO_NO_BUDGETS\n", argv[i]);
+            return 1;
+#endif
+            if (strcmp(argv[i], "--fuel")==0){
+                fuel_limit = fuel_left = limit;
+            } else {
+                memory_limit = limit;
+            }
+            i++;
+        } else if (argv[i][0] != '-' && filename == NULL){
+            filename = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (resume != NULL){
+        if (filename != NULL || compile || bench_lex || bench_parse || watch){
+            usage(argv[0]);
+            return 1;
+        }
+        resume_image(resume);
+        return 0;
+    }
+
+    if (filename == NULL || (output != NULL && !compile)){
+        usage(argv[0]);
         return 1;
     }
 
-    const char* filename = argv[1];
+    if (watch){
+        if (compile || bench_lex || bench_parse || snapshot_path != NULL){
+            usage(argv[0]);
+            return 1;
+        }
+        return watch_file(filename);
+    }
+
+    if (compile){
+        return compile_file(filename, output, build);
+    }
+
+    if (bench_lex){
+        return bench_lex_file(filename);
+    }
+
+    if (bench_parse){
+        return bench_parse_file(filename);
+    }
 
     interpret_file(filename);
 
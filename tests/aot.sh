@@ -0,0 +1,37 @@
+#!/bin/sh
+# Checks that every program in examples/, bench/ and tests/ prints the same
+# output when interpreted (pavo X) and when compiled (pavo build X && ./X).
+# A program with a X.expected file next to it must also print exactly that.
+# The "execution time" line differs between runs and is left out.
+# usage: tests/aot.sh
+
+dir=$(dirname "$0")/..
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+${CC:-cc} -O2 -pthread -o "$tmp/pavo" "$dir/src/pavo.c" || exit 1
+
+failed=0
+for program in "$dir"/examples/*.pavo "$dir"/bench/*.pavo "$dir"/tests/*.pavo; do
+    [ -f "$program" ] || continue
+    name=$(basename "$program" .pavo)
+    "$tmp/pavo" "$program" 2>&1 | grep -v '^execution time: ' > "$tmp/interpreted"
+    if ! "$tmp/pavo" build "$program" -o "$tmp/$name" > /dev/null; then
+        echo "FAIL $program: build failed"
+        failed=1
+        continue
+    fi
+    "$tmp/$name" 2>&1 | grep -v '^execution time: ' > "$tmp/compiled"
+    if ! cmp -s "$tmp/interpreted" "$tmp/compiled"; then
+        echo "FAIL $program: compiled output differs"
+        diff "$tmp/interpreted" "$tmp/compiled" | head -n 10
+        failed=1
+    elif [ -f "${program%.pavo}.expected" ] && ! cmp -s "$tmp/interpreted" "${program%.pavo}.expected"; then
+        echo "FAIL $program: output differs from $(basename "${program%.pavo}.expected")"
+        diff "${program%.pavo}.expected" "$tmp/interpreted" | head -n 10
+        failed=1
+    else
+        echo "ok   $program"
+    fi
+done
+exit $failed